@@ -26,7 +26,7 @@ TEST_SRC_DIR:=$(MODULE_DIR)test/
 S_OBJS=$(patsubst $(SRC_DIR)%.s,$(BLD_DIR)%.o,$(wildcard $(SRC_DIR)*.s))
 SS_OBJS=$(patsubst $(SRC_DIR)%.S,$(BLD_DIR)%.o,$(wildcard $(SRC_DIR)*.S))
 C_OBJS=$(patsubst $(SRC_DIR)%.c,$(BLD_DIR)%.o,$(wildcard $(SRC_DIR)*.c))
-DEPS = $(C_OBJS:%.o=%.d)
+DEPS = $(C_OBJS:%.o=%.d) $(SS_OBJS:%.o=%.d)
 OBJS=$(S_OBJS) $(SS_OBJS) $(C_OBJS)
 IMAGES=$(BLD_DIR)kernel.img
 
@@ -35,10 +35,15 @@ $(BLD_DIR)%.o: $(SRC_DIR)%.s
 	mkdir -p $(BLD_DIR)
 	$(TOOLCHAIN)as $< -o $@
 
+# Create object files from assembly source files that use the C preprocessor
+$(BLD_DIR)%.o: $(SRC_DIR)%.S
+	@mkdir -p $(BLD_DIR)
+	$(TOOLCHAIN)gcc -nostdlib -nostartfiles -ffreestanding -MMD $(CFLAGS) $(TARGET_CFLAGS) -c $< -o $@
+
 # Create object files from C source files
 $(BLD_DIR)%.o: $(SRC_DIR)%.c
 	@mkdir -p $(BLD_DIR)
-	$(TOOLCHAIN)gcc -std=c99 -Wall -Werror -O2 -nostdlib -nostartfiles -ffreestanding -MMD -c $< -o $@
+	$(TOOLCHAIN)gcc -std=c99 -Wall -Werror -O2 -nostdlib -nostartfiles -ffreestanding -MMD $(CFLAGS) $(TARGET_CFLAGS) -c $< -o $@
 
 all: $(IMAGES)
 
@@ -56,6 +61,8 @@ info:
 	@echo "OBJS:       $(OBJS)"
 	@echo "IMAGES:     $(IMAGES)"
 	@echo "DEPS:       $(DEPS)"
+	@echo "CFLAGS:     $(CFLAGS)"
+	@echo "TARGET_CFLAGS: $(TARGET_CFLAGS)"
 
 install: $(IMAGES)
 	@[ -d "$(PART_PATH)" ] || (echo "Please insert SD card, mounted at $(PART_PATH), and then try again" && false)
@@ -72,9 +79,9 @@ clean:
 $(BLD_DIR)kernel.img: $(BLD_DIR)kernel.elf
 	$(TOOLCHAIN)objcopy $(BLD_DIR)kernel.elf -O binary $@
 
-$(BLD_DIR)kernel.elf: $(OBJS) $(SRC_DIR)kernel.ld
+$(BLD_DIR)kernel.elf: $(OBJS) $(wildcard $(SRC_DIR)*.ld)
 	# Create ELF file
-	$(TOOLCHAIN)gcc -nostartfiles $(OBJS) -T $(SRC_DIR)kernel.ld -o $@
+	$(TOOLCHAIN)gcc -nostartfiles $(TARGET_CFLAGS) $(LDFLAGS) $(OBJS) -L $(SRC_DIR) -T $(SRC_DIR)kernel.ld -o $@
 	# Dump ELF file, as it is intructive to look at ;-)
 	$(TOOLCHAIN)objdump -d $@ > $@.dump
 
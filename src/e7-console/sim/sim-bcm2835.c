@@ -0,0 +1,286 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* sim-bcm2835.c
+ *
+ * Hardware model for the host-native simulator: ARM timer, system timer,
+ * cycle counter, GPIO and a console UART backed by stdin/stdout.
+ */
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#include "sim.h"
+#include "bcm2835.h"
+#include "str.h"
+#include "klog.h"
+#include "trace.h"
+
+static IRQ_Registers sim_irq_registers;
+static System_Timer_Registers sim_system_timer_registers;
+static Timer_Registers sim_timer_registers = { .pre_divider = 0x7D }; // reset value
+static GPIO_Registers sim_gpio_registers;
+
+volatile IRQ_Registers * irq_registers = &sim_irq_registers;
+volatile System_Timer_Registers * system_timer_registers = &sim_system_timer_registers;
+volatile Timer_Registers * timer_registers = &sim_timer_registers;
+volatile GPIO_Registers * gpio_registers = &sim_gpio_registers;
+
+static uint64_t timer_expiry_ns; // Virtual time at which the ARM timer next expires (0 if not running)
+
+/*! ARM timer period: the timer is clocked from the APB clock, via the pre-divider and pre-scaler */
+static uint64_t timer_period_ns(void) {
+    static const uint32_t prescale[] = { 1, 16, 256, 1 };
+    uint64_t counts = (uint64_t)timer_registers->load
+                    * (timer_registers->pre_divider+1)
+                    * prescale[(timer_registers->control>>2)&0b11];
+    uint64_t ns = counts*1000000000ULL/CORE_CLOCK_HZ;
+    return ns ? ns : 1;
+}
+
+static bool timer_running(void) {
+    uint32_t enabled = TIMER_CTRL_ENABLE | TIMER_CTRL_INT_ENABLE;
+    return (timer_registers->control & enabled)==enabled;
+}
+
+bool sim_hw_update(uint64_t now_ns) {
+    if(timer_running()) {
+        if(!timer_expiry_ns) {
+            timer_expiry_ns = now_ns + timer_period_ns();
+        } else if(now_ns>=timer_expiry_ns) {
+            timer_registers->raw_irq = 1;
+            timer_registers->masked_irq = 1;
+            irq_registers->irq_basic_pending |= IRQ_TIMER;
+            timer_expiry_ns += timer_period_ns();
+            if(timer_expiry_ns<=now_ns) {
+                // Missed ticks (e.g. a long busy-wait) are coalesced into one
+                timer_expiry_ns = now_ns + timer_period_ns();
+            }
+            // Check for console input at the same rate as the timer
+            sim_hw_poll_console(0);
+        }
+    } else {
+        timer_expiry_ns = 0;
+    }
+    return timer_registers->masked_irq || uart_irq_pending();
+}
+
+uint64_t sim_hw_next_event(uint64_t now_ns) {
+    if(timer_running() && timer_expiry_ns) {
+        return timer_expiry_ns;
+    }
+    return now_ns + 1000000;
+}
+
+void sim_hw_ack(void) {
+    if(timer_registers->irq_ack) {
+        timer_registers->irq_ack = 0;
+        timer_registers->raw_irq = 0;
+        timer_registers->masked_irq = 0;
+        irq_registers->irq_basic_pending &= ~IRQ_TIMER;
+    }
+}
+
+int gpio_set_func(unsigned int gpio, unsigned func) {
+    if(gpio>=GPIO_MAX) {
+        return 1;
+    }
+    if(func>=GPF_MAX) {
+        return 2;
+    }
+    return 0;
+}
+
+int gpio_write(unsigned int gpio, unsigned int level) {
+    if(gpio>=GPIO_MAX) {
+        return 1;
+    }
+    uint32_t bank = (gpio>>5) ? 1 : 0;
+    uint32_t bit = (1<<(gpio&0x1F));
+    if(level) {
+        gpio_registers->lev[bank] |= bit;
+    } else {
+        gpio_registers->lev[bank] &= ~bit;
+    }
+    return 0;
+}
+
+int gpio_write_mask(unsigned int bank, uint32_t set_mask, uint32_t clr_mask) {
+    if(bank>=GPIO_BANKS) {
+        return 1;
+    }
+    gpio_registers->lev[bank] = (gpio_registers->lev[bank] | set_mask) & ~clr_mask;
+    return 0;
+}
+
+uint32_t gpio_read_bank(unsigned int bank) {
+    if(bank>=GPIO_BANKS) {
+        return 0;
+    }
+    return gpio_registers->lev[bank];
+}
+
+// No GPIO inputs are modelled, so no events are ever detected
+int gpio_irq_config(unsigned int gpio, unsigned int events) {
+    return gpio>=GPIO_MAX ? 1 : 0;
+}
+
+bool gpio_irq_pending() {
+    return false;
+}
+
+uint32_t gpio_irq() {
+    return 0;
+}
+
+uint32_t clock_set_rate(uint32_t clock_id, uint32_t hz) {
+    return hz;
+}
+
+// Console UART: receive buffer filled from stdin, transmit straight to stdout
+
+#define UART_RX_SIZE 64
+static struct {
+    uint8_t buf[UART_RX_SIZE];
+    uint32_t head;  // next byte to read
+    uint32_t tail;  // next byte to write
+} uart_rx;
+static bool uart_eof;
+static bool uart_rx_irq; // Data has been received since the last uart_irq
+
+void sim_hw_poll_console(uint64_t timeout_ns) {
+    if(uart_eof) {
+        if(timeout_ns) {
+            usleep(timeout_ns/1000);
+        }
+        return;
+    }
+    uint32_t space = UART_RX_SIZE - (uart_rx.tail - uart_rx.head);
+    if(space==0) {
+        return;
+    }
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    if(poll(&pfd,1,(int)(timeout_ns/1000000))<=0) {
+        return;
+    }
+    uint8_t buf[UART_RX_SIZE];
+    ssize_t n = read(STDIN_FILENO,buf,space);
+    if(n<=0) {
+        uart_eof = true;
+        return;
+    }
+    for(ssize_t i=0; i<n; i++) {
+        uart_rx.buf[uart_rx.tail++ % UART_RX_SIZE] = buf[i];
+    }
+    uart_rx_irq = true;
+}
+
+bool sim_hw_console_eof(void) {
+    return uart_eof && uart_rx.head==uart_rx.tail;
+}
+
+void uart_init(Baud baud) {
+}
+
+void uart_putc(uint8_t c) {
+    putc(c,stdout);
+}
+
+void uart_puts(const char * str) {
+    while(*str) {
+        uart_putc(*str++);
+    }
+}
+
+void uart_putn(int val) {
+    char buff[19];
+    itoa(val,buff,10);
+    uart_puts(buff);
+}
+
+uint8_t uart_getc() {
+    while(uart_rx.head==uart_rx.tail) {
+        if(uart_eof) {
+            sim_exit(0);
+        }
+        sim_hw_poll_console(1000000);
+    }
+    return uart_rx.buf[uart_rx.head++ % UART_RX_SIZE];
+}
+
+uint32_t uart_read(uint8_t * buf, uint32_t len) {
+    uint32_t n = 0;
+    while(n<len && uart_rx.head!=uart_rx.tail) {
+        buf[n++] = uart_rx.buf[uart_rx.head++ % UART_RX_SIZE];
+    }
+    return n;
+}
+
+uint32_t uart_rx_count(void) {
+    return uart_rx.tail-uart_rx.head;
+}
+
+uint32_t uart_write(const uint8_t * buf, uint32_t len) {
+    return fwrite(buf,1,len,stdout);
+}
+
+bool uart_irq_pending() {
+    return uart_rx_irq;
+}
+
+uint32_t uart_irq() {
+    bool pending = uart_rx_irq;
+    uart_rx_irq = false;
+    return pending ? UART_RX : 0;
+}
+
+void uart_flush() {
+    fflush(stdout);
+}
+
+uint64_t system_timer(void) {
+    return sim_clock_ns()/1000;
+}
+
+void cycle_counter_init(void) {
+}
+
+uint32_t cycle_counter(void) {
+    return sim_clock_ns()*(CPU_CLOCK_HZ/1000000)/1000;
+}
+
+// No cache or branch predictor model; the event counters don't count
+void pmu_select(uint32_t evt0, uint32_t evt1) {
+}
+
+void pmu_read(uint32_t * evt0, uint32_t * evt1) {
+    *evt0 = 0;
+    *evt1 = 0;
+}
+
+void swi_entry_select(bool baseline) {
+    // The sim calls the router directly; there is no entry path to switch
+}
+
+void cpu_idle(void) {
+    sim_idle();
+}
+
+uint32_t busy_wait_millis(uint32_t millis) {
+    sim_advance((uint64_t)millis*1000000);
+    return millis;
+}
+
+void panic(int code) {
+    char buff[8];
+    klog_flush();
+    uart_puts("\033[31;1m");
+    uart_puts("panic: code=");
+    uart_puts(itoa(code,buff,10));
+    uart_puts("\033[0m");
+    uart_puts("\r\n");
+    if(TRACE_ENABLED && TRACE_FLIGHT_RECORDER) {
+        trace_dump();
+    }
+    sim_exit(128+code);
+}
@@ -0,0 +1,200 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* sim-syscalls.c
+ *
+ * System-call stubs for the host-native simulator; the equivalent of the
+ * sys_* stubs in start.S.
+ */
+#include "toast.h"
+#include "swi-ops.h"
+#include "sim.h"
+
+uint32_t sys_set_led(uint32_t led, uint32_t val) {
+    return sim_swi(SWI_SET_LED,led,val,0);
+}
+
+uint32_t sys_gpio_write_mask(uint32_t bank, uint32_t set_mask, uint32_t clr_mask) {
+    return sim_swi(SWI_GPIO_WRITE_MASK,bank,set_mask,clr_mask);
+}
+
+uint32_t sys_gpio_read_bank(uint32_t bank) {
+    return sim_swi(SWI_GPIO_READ_BANK,bank,0,0);
+}
+
+uint32_t sys_gpio_irq(uint32_t gpio, uint32_t events, uint32_t debounce_us) {
+    return sim_swi(SWI_GPIO_IRQ,gpio,events,debounce_us);
+}
+
+uint32_t sys_gpio_wait(uint32_t pin_mask, uint32_t timeout_millis, uint32_t * timestamp_us) {
+    return sim_swi(SWI_GPIO_WAIT,pin_mask,timeout_millis,(uint32_t)timestamp_us);
+}
+
+// The user-mode clock doesn't trap (see toast_now_us in bcm2835.c)
+uint64_t toast_now_us(void) {
+    return sim_clock_ns()/1000;
+}
+
+uint64_t toast_now_ms(void) {
+    return sim_clock_ns()/1000000;
+}
+
+uint32_t sys_clock_millis() {
+    return sim_swi(SWI_CLOCK_MILLIS,0,0,0);
+}
+
+uint32_t sys_cycles(void) {
+    return sim_swi(SWI_CYCLES,0,0,0);
+}
+
+int sys_fork(ProcessMainFn main, uint32_t init_param, uint32_t priority) {
+    return sim_swi(SWI_FORK,(uint32_t)main,init_param,priority);
+}
+
+void sys_yield() {
+    sim_swi(SWI_YIELD,0,0,0);
+}
+
+uint32_t sys_sleep_millis(uint32_t millis) {
+    return sim_swi(SWI_SLEEP_MILLIS,millis,0,0);
+}
+
+uint32_t sys_mon_create() {
+    return sim_swi(SWI_MON_CREATE,0,0,0);
+}
+
+uint32_t sys_mon_enter(uint32_t mid) {
+    return sim_swi(SWI_MON_ENTER,mid,0,0);
+}
+
+void sys_mon_exit(uint32_t mid) {
+    sim_swi(SWI_MON_EXIT,mid,0,0);
+}
+
+void sys_mon_wait(uint32_t mid) {
+    sim_swi(SWI_MON_WAIT,mid,0,0);
+}
+
+void sys_mon_notify(uint32_t mid) {
+    sim_swi(SWI_MON_NOTIFY,mid,0,0);
+}
+
+uint32_t sys_sem_create(uint32_t count) {
+    return sim_swi(SWI_SEM_CREATE,count,0,0);
+}
+
+void sys_sem_wait(uint32_t sid) {
+    sim_swi(SWI_SEM_WAIT,sid,0,0);
+}
+
+void sys_sem_signal(uint32_t sid) {
+    sim_swi(SWI_SEM_SIGNAL,sid,0,0);
+}
+
+uint32_t sys_evt_create() {
+    return sim_swi(SWI_EVT_CREATE,0,0,0);
+}
+
+uint32_t sys_evt_wait(uint32_t eid, uint32_t mask, uint32_t mode) {
+    return sim_swi(SWI_EVT_WAIT,eid,mask,mode);
+}
+
+void sys_evt_set(uint32_t eid, uint32_t mask) {
+    sim_swi(SWI_EVT_SET,eid,mask,0);
+}
+
+void sys_evt_clear(uint32_t eid, uint32_t mask) {
+    sim_swi(SWI_EVT_CLEAR,eid,mask,0);
+}
+
+uint32_t sys_wait(uint32_t pid, uint32_t * exit_code) {
+    return sim_swi(SWI_WAIT,pid,(uint32_t)exit_code,0);
+}
+
+uint32_t sys_try_wait(uint32_t pid, uint32_t * exit_code) {
+    return sim_swi(SWI_WAIT,pid,(uint32_t)exit_code,1);
+}
+
+uint32_t sys_read(void * buf, uint32_t len) {
+    return sim_swi(SWI_READ,(uint32_t)buf,len,0);
+}
+
+uint32_t sys_write(const void * buf, uint32_t len) {
+    return sim_swi(SWI_WRITE,(uint32_t)buf,len,0);
+}
+
+uint32_t _proc_main(uint32_t entry_point, uint32_t init_param) {
+    sys_exit(((ProcessMainFn)entry_point)(init_param));
+}
+
+_Noreturn uint32_t sys_exit(uint32_t exit_code) {
+    sim_swi(SWI_EXIT,exit_code,0,0);
+    // A terminated process is never dispatched again
+    sim_exit(1);
+}
+
+void sys_log(const char * str) {
+    sim_swi(SWI_LOG,(uint32_t)str,0,0);
+}
+
+uint32_t sys_get_pid(void) {
+    return sim_swi(SWI_GET_PID,0,0,0);
+}
+
+uint32_t sys_proc_info(uint32_t pid, ProcInfo * info) {
+    return sim_swi(SWI_PROC_INFO,pid,(uint32_t)info,0);
+}
+
+void sys_prof_ctl(uint32_t period) {
+    sim_swi(SWI_PROF_CTL,period,0,0);
+}
+
+uint32_t sys_prof_read(uint32_t index, ProfSample * sample) {
+    return sim_swi(SWI_PROF_READ,index,(uint32_t)sample,0);
+}
+
+uint32_t sys_swi_stat(uint32_t swi, SwiStat * stat) {
+    return sim_swi(SWI_SWI_STAT,swi,(uint32_t)stat,0);
+}
+
+void sys_perf_ctl(uint32_t evt0, uint32_t evt1) {
+    sim_swi(SWI_PERF_CTL,evt0,evt1,0);
+}
+
+uint32_t sys_perf_read(uint32_t pid, uint32_t who, PerfStat * stat) {
+    return sim_swi(SWI_PERF_READ,pid,who,(uint32_t)stat);
+}
+
+uint32_t sys_spawn_batch(ProcessMainFn main, uint32_t count, uint32_t priority) {
+    return sim_swi(SWI_SPAWN_BATCH,(uint32_t)main,count,priority);
+}
+
+uint32_t sys_wait_any(const WaitSource * sources, uint32_t count) {
+    return sim_swi(SWI_WAIT_ANY,(uint32_t)sources,count,0);
+}
+
+void sys_sleep_until(uint64_t deadline_us) {
+    sim_swi(SWI_SLEEP_UNTIL,(uint32_t)deadline_us,(uint32_t)(deadline_us>>32),0);
+}
+
+uint32_t sys_timer_create(uint32_t period_us) {
+    return sim_swi(SWI_TIMER_CREATE,period_us,0,0);
+}
+
+uint32_t sys_timer_wait(uint32_t tid) {
+    return sim_swi(SWI_TIMER_WAIT,tid,0,0);
+}
+
+void sys_ring_setup(Ring * ring, uint32_t flags) {
+    sim_swi(SWI_RING_SETUP,(uint32_t)ring,flags,0);
+}
+
+uint32_t sys_ring_enter(void) {
+    return sim_swi(SWI_RING_ENTER,0,0,0);
+}
+
+void sys_entry_baseline(bool baseline) {
+    sim_swi(SWI_ENTRY_BASELINE,baseline,0,0);
+}
+
+uint32_t sys_get_pid_baseline(void) {
+    return sim_swi(SWI_GET_PID,0,0,0);
+}
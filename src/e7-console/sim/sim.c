@@ -0,0 +1,220 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* sim.c
+ *
+ * Host-native simulator: coroutines, system-call entry, and the virtual
+ * clock that drives the scheduler.
+ *
+ * The kernel is single-threaded and only runs at well-defined points, so the
+ * simulation is deterministic: a process runs until it makes a system call,
+ * each system call advances the virtual clock, and pending interrupts are
+ * delivered to s_schedule before the call returns. A process that spins
+ * without making system calls is never preempted.
+ */
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <ucontext.h>
+#include "sim.h"
+#include "proctl.h"
+#include "arm.h"
+#include "bcm2835.h"
+#include "klog.h"
+#include "swistat.h"
+#include "boot.h"
+
+Process * s_init(void);
+Process * s_schedule(Process * running);
+Process * s_sys_router(Process * running, int swi_num, uint32_t * args);
+
+#define SIM_MAX_PROCESS 16
+#define SIM_STACK_SIZE  0x10000
+
+static ucontext_t main_ctx;
+static ucontext_t proc_ctx[SIM_MAX_PROCESS];
+static uint8_t proc_stack[SIM_MAX_PROCESS][SIM_STACK_SIZE] __attribute__((aligned(16)));
+
+static Process * running;
+static uint64_t clock_ns;
+
+static struct {
+    uint64_t limit_ns;      // Stop at this virtual time (0 for no limit)
+    uint64_t eof_ns;        // Virtual time at which console input reached EOF
+    bool realtime;          // Pace the virtual clock to the host clock when idle
+} options;
+
+static struct {
+    uint64_t swis;          // System calls
+    uint64_t switches;      // Context switches
+    uint64_t irqs;          // Interrupts delivered to the scheduler
+    struct timespec start;  // Host time at start-up
+} stats;
+
+// After console input reaches EOF, keep running for a while to let output drain
+#define SIM_EOF_GRACE_NS 1000000000ULL
+
+static double host_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (now.tv_sec-stats.start.tv_sec) + (now.tv_nsec-stats.start.tv_nsec)/1e9;
+}
+
+uint64_t sim_clock_ns(void) {
+    return clock_ns;
+}
+
+void sim_advance(uint64_t ns) {
+    clock_ns += ns;
+}
+
+_Noreturn void sim_exit(int code) {
+    klog_flush();
+    fflush(stdout);
+    double secs = host_seconds();
+    fprintf(stderr,
+        "\nsim: virtual %llu ms, host %.3f s, %llu SWIs, %llu switches, %llu IRQs, %.0f switches/s\n",
+        (unsigned long long)(clock_ns/1000000),
+        secs,
+        (unsigned long long)stats.swis,
+        (unsigned long long)stats.switches,
+        (unsigned long long)stats.irqs,
+        secs>0 ? stats.switches/secs : 0.0);
+    exit(code);
+}
+
+// Coroutine entry point for a new process
+static void sim_start(void) {
+    _proc_main(running->registers[R_R0],running->registers[R_R1]);
+}
+
+/*! Switch to the given process (the equivalent of dispatch in start.S) */
+static void sim_dispatch(Process * next) {
+    Process * prev = running;
+    running = next;
+    if(next==prev) {
+        return;
+    }
+    if(next->pid>=SIM_MAX_PROCESS) {
+        fprintf(stderr,"sim: pid %u exceeds SIM_MAX_PROCESS\n",(unsigned)next->pid);
+        sim_exit(1);
+    }
+    stats.switches++;
+    ucontext_t * to = &proc_ctx[next->pid];
+    if(next->pc==(uint32_t)_proc_main) {
+        // A new process; start a coroutine on the stack for its process slot
+        getcontext(to);
+        to->uc_stack.ss_sp = proc_stack[next->pid];
+        to->uc_stack.ss_size = SIM_STACK_SIZE;
+        to->uc_link = NULL;
+        makecontext(to,sim_start,0);
+        next->pc = (uint32_t)sim_start;
+    }
+    swapcontext(prev ? &proc_ctx[prev->pid] : &main_ctx, to);
+}
+
+/*! Deliver pending interrupts to the scheduler */
+static void sim_interrupt(void) {
+    if(sim_hw_update(clock_ns)) {
+        stats.irqs++;
+        Process * next = s_schedule(running);
+        sim_hw_ack();
+        sim_dispatch(next);
+    }
+    if(sim_hw_console_eof() && !options.eof_ns) {
+        options.eof_ns = clock_ns;
+    }
+    if((options.limit_ns && clock_ns>=options.limit_ns)
+        || (options.eof_ns && clock_ns>=options.eof_ns+SIM_EOF_GRACE_NS)) {
+        sim_exit(0);
+    }
+}
+
+uint32_t sim_swi(uint32_t swi_num, uint32_t r0, uint32_t r1, uint32_t r2) {
+    Process * self = running;
+    uint32_t args[4] = { r0, r1, r2, 0 };
+    stats.swis++;
+    swi_entry_cycles = cycle_counter();
+    clock_ns += SIM_SWI_NS;
+    Process * dispatch = s_sys_router(self,swi_num,args);
+    uint32_t result = args[0];
+    if(dispatch) {
+        // Blocking system call; the result is delivered in r0 when the process resumes
+        self->registers[R_R0] = args[0];
+        sim_dispatch(dispatch);
+        result = self->registers[R_R0];
+    }
+    sim_interrupt();
+    return result;
+}
+
+void sim_idle(void) {
+    uint64_t next = sim_hw_next_event(clock_ns);
+    if(options.realtime) {
+        fflush(stdout);
+        double ahead = next/1e9 - host_seconds();
+        sim_hw_poll_console(ahead>0 ? (uint64_t)(ahead*1e9) : 0);
+    } else {
+        sim_hw_poll_console(0);
+    }
+    if(next>clock_ns) {
+        clock_ns = next;
+    }
+    sim_interrupt();
+}
+
+static struct termios saved_termios;
+
+static void restore_terminal(void) {
+    tcsetattr(STDIN_FILENO,TCSANOW,&saved_termios);
+}
+
+static void usage(const char * name) {
+    fprintf(stderr,"usage: %s [-r] [-t millis]\n",name);
+    fprintf(stderr,"  -r         pace the virtual clock to the host clock (default when input is a terminal)\n");
+    fprintf(stderr,"  -t millis  stop after running for the given virtual time\n");
+    exit(2);
+}
+
+int main(int argc, char ** argv) {
+    options.realtime = isatty(STDIN_FILENO);
+    int opt;
+    while((opt=getopt(argc,argv,"rt:"))!=-1) {
+        switch(opt) {
+        case 'r':
+            options.realtime = true;
+            break;
+        case 't':
+            options.limit_ns = strtoull(optarg,NULL,10)*1000000;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if(isatty(STDIN_FILENO)) {
+        // The console does its own echo and line editing
+        struct termios raw;
+        tcgetattr(STDIN_FILENO,&saved_termios);
+        raw = saved_termios;
+        raw.c_lflag &= ~(ICANON|ECHO);
+        tcsetattr(STDIN_FILENO,TCSANOW,&raw);
+        atexit(restore_terminal);
+    }
+    // (reset_handler, in start.S)
+    boot_mark(BOOT_RESET);
+    boot_mark(BOOT_VECTORS);
+    Process * first = s_init();
+    if(options.limit_ns) {
+        // The time limit starts once the kernel has been initialized
+        options.limit_ns += clock_ns;
+    }
+    clock_gettime(CLOCK_MONOTONIC,&stats.start);
+    running = NULL;
+    sim_dispatch(first);
+    // Not reached; the simulation ends with sim_exit
+    return 0;
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __SIM_H__
+#define __SIM_H__
+/* sim.h
+ *
+ * Host-native simulator. TOAST processes run as coroutines, system calls are
+ * direct calls into the system-call router, and interrupts are delivered at
+ * system-call boundaries (and when idle), driven by a virtual clock.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+// Virtual time charged for each system call
+#ifndef SIM_SWI_NS
+#define SIM_SWI_NS 500
+#endif
+
+/*! Enter the kernel with a system call. Returns the result of the call (r0) */
+uint32_t sim_swi(uint32_t swi_num, uint32_t r0, uint32_t r1, uint32_t r2);
+/*! Wait for the next interrupt */
+void sim_idle(void);
+/*! Current virtual time in nanoseconds */
+uint64_t sim_clock_ns(void);
+/*! Advance the virtual clock */
+void sim_advance(uint64_t ns);
+/*! Print statistics and exit */
+_Noreturn void sim_exit(int code);
+
+// Hardware model (sim-bcm2835.c)
+
+/*! Update the hardware model to the current virtual time. Returns true if an IRQ is pending */
+bool sim_hw_update(uint64_t now_ns);
+/*! Virtual time of the next timer interrupt (or now + 1ms, if the timer is disabled) */
+uint64_t sim_hw_next_event(uint64_t now_ns);
+/*! Apply interrupt acknowledgements written by the kernel */
+void sim_hw_ack(void);
+/*! Poll the host for console input, waiting up to timeout_ns (0 to not wait) */
+void sim_hw_poll_console(uint64_t timeout_ns);
+/*! Returns true once console input has reached end-of-file */
+bool sim_hw_console_eof(void);
+
+// Process entry trampoline (sim-syscalls.c)
+uint32_t _proc_main(uint32_t entry_point, uint32_t init_param);
+
+#endif // __SIM_H__
@@ -1,76 +1,69 @@
 // Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
 #include "toast.h"
 
-volatile uint32_t ready = false;
+#define EVT_READY 0b00000001
+
 uint32_t green_blinker(uint32_t);
 uint32_t yellow_blinker(uint32_t);
 
 uint32_t app_main(uint32_t init_param) {
     sys_log("app_main is running");
-    ready = false;
     sys_set_led(SYS_LED_RED,1);
 
-    // Create a monitor
-    uint32_t mid = sys_mon_create();
+    // Create an event flag group
+    uint32_t eid = sys_evt_create();
 
-    // Fork-off a couple processes,passing in the monitor
+    // Fork-off a couple processes, passing in the event flag group
     sys_log("app_main is forking child processes");
-    sys_fork(green_blinker,mid,0);
-    sys_fork(yellow_blinker,mid,0);
+    sys_fork(green_blinker,eid,0);
+    sys_fork(yellow_blinker,eid,0);
 
     sys_log("app_main is sleeping for a bit");
     sys_sleep_millis(2000);
 
     // Notify child processes that we're ready
     sys_log("app_main is notifying child processes");
-    sys_mon_enter(mid);
-    ready = true;
-    sys_mon_notify(mid);
-    sys_mon_exit(mid);
+    sys_evt_set(eid,EVT_READY);
     // Exit this process (child processes will continue running)
     sys_set_led(SYS_LED_RED,0);
     sys_log("app_main is exiting");
     return 0;
 }
 
-uint32_t green_blinker(uint32_t mid) {
+#define GREEN_ON_MILLIS 800
+#define GREEN_PERIOD_US ((GREEN_ON_MILLIS+200)*1000)
+
+uint32_t green_blinker(uint32_t eid) {
     // Don't start until ready
     sys_log("green_blinker is waiting for ready signal...");
-    sys_mon_enter(mid);
-    while(!ready) {
-        sys_mon_wait(mid);
-    }
-    // notify anyone else that might be waiting
-    sys_mon_notify(mid);
-    sys_mon_exit(mid);
+    sys_evt_wait(eid,EVT_READY,EVT_WAIT_ANY);
     sys_log("green_blinker is running");
+    // The timer starts each period on schedule; the ON time ends at an absolute deadline within it
+    uint32_t tid = sys_timer_create(GREEN_PERIOD_US);
     while(1) {
         // ON
+        uint64_t start = toast_now_us();
         sys_set_led(SYS_LED_GREEN,1);
-        sys_sleep_millis(800);
+        sys_sleep_until(start+GREEN_ON_MILLIS*1000);
         // OFF
         sys_set_led(SYS_LED_GREEN,0);
-        sys_sleep_millis(200);
+        if(sys_timer_wait(tid)) {
+            sys_log("green_blinker overran its period");
+        }
     }
 }
 
-uint32_t yellow_blinker(uint32_t mid) {
+uint32_t yellow_blinker(uint32_t eid) {
     // Don't start until ready
     sys_log("yellow_blinker is waiting for ready signal...");
-    sys_mon_enter(mid);
-    while(!ready) {
-        sys_mon_wait(mid);
-    }
-    // notify anyone else that might be waiting
-    sys_mon_notify(mid);
-    sys_mon_exit(mid);
+    sys_evt_wait(eid,EVT_READY,EVT_WAIT_ANY);
     sys_log("yellow_blinker is running");
+    // Toggle every 300ms
+    uint32_t tid = sys_timer_create(300*1000);
+    uint32_t on = 1;
     while(1) {
-        // ON
-        sys_set_led(SYS_LED_YELLOW,1);
-        sys_sleep_millis(300);
-        // OFF
-        sys_set_led(SYS_LED_YELLOW,0);
-        sys_sleep_millis(300);
+        sys_set_led(SYS_LED_YELLOW,on);
+        on = !on;
+        sys_timer_wait(tid);
     }
 }
@@ -11,6 +11,8 @@
 #define CPSR_MODE_ABT       0b00010111  // Abort mode
 #define CPSR_MODE_UND       0b00011011  // Undefined mode
 #define CPSR_MODE_SYS       0b00011111  // System mode
+#define CPSR_MODE_HYP       0b00011010  // Hypervisor mode (ARMv7 virtualization extensions)
+#define CPSR_MODE_MASK      0b00011111
 // A2.5.6 The interrupt disable bits (F & I bits)
 #define CPSR_DISABLE_FIQ    0b01000000  // Disable FIQ
 #define CPSR_DISABLE_IRQ    0b10000000  // Disable IRQ    
@@ -21,4 +23,15 @@
 #define R_SP 13
 #define R_LR 14
 
+// Data memory barrier: memory accesses before it are observed (by other cores,
+// and by a User-mode consumer) before those after it. Use it around the head
+// and tail of a ring shared by a producer and a consumer. User-mode safe.
+#if defined(__ARM_ARCH) && __ARM_ARCH>=7
+#define MEMORY_BARRIER() __asm__ __volatile__("dmb" ::: "memory")
+#elif defined(__arm__)
+#define MEMORY_BARRIER() __asm__ __volatile__("mcr p15, 0, %0, c7, c10, 5" :: "r"(0) : "memory") // ARMv6 DMB
+#else
+#define MEMORY_BARRIER() __asm__ __volatile__("" ::: "memory") // Host-native simulator and tests (one thread)
+#endif
+
 #endif // __ARM_H__
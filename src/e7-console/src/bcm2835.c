@@ -2,7 +2,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "bcm2835.h"
-#include "str.h"
+#include "kprintf.h"
+#include "klog.h"
+#include "trace.h"
 
 void busywait(uint32_t n);
 
@@ -43,6 +45,120 @@ int gpio_write(unsigned int gpio, unsigned int level) {
     return 0;
 }
 
+int gpio_write_mask(unsigned int bank, uint32_t set_mask, uint32_t clr_mask) {
+    if(bank>=GPIO_BANKS) {
+        return 1;
+    }
+    // Writing 0 bits has no effect, so each is a single register write
+    if(set_mask) {
+        gpio_registers->set[bank] = set_mask;
+    }
+    if(clr_mask) {
+        gpio_registers->clr[bank] = clr_mask;
+    }
+    return 0;
+}
+
+uint32_t gpio_read_bank(unsigned int bank) {
+    if(bank>=GPIO_BANKS) {
+        return 0;
+    }
+    return gpio_registers->lev[bank];
+}
+
+int gpio_irq_config(unsigned int gpio, unsigned int events) {
+    if(gpio>=GPIO_MAX) {
+        return 1;
+    }
+    uint32_t bank = gpio>>5;
+    uint32_t bit = 1<<(gpio&0x1F);
+    volatile uint32_t * regs[6] = {
+        &gpio_registers->eren[bank], &gpio_registers->efen[bank],
+        &gpio_registers->hen[bank], &gpio_registers->len[bank],
+        &gpio_registers->aren[bank], &gpio_registers->afen[bank]
+    };
+    for(int i=0; i<6; i++) {
+        if(events & (1<<i)) {
+            *regs[i] |= bit;
+        } else {
+            *regs[i] &= ~bit;
+        }
+    }
+    gpio_registers->eds[bank] = bit;
+    return 0;
+}
+
+bool gpio_irq_pending() {
+    return irq_registers->irq_pending_2 & IRQ_2_GPIO;
+}
+
+uint32_t gpio_irq() {
+    uint32_t events = gpio_registers->eds[0];
+    gpio_registers->hen[0] &= ~events;
+    gpio_registers->len[0] &= ~events;
+    gpio_registers->eds[0] = events; // write 1 to clear
+    return events;
+}
+
+#if SMP_CPUS>1
+// The data cache is enabled (see mmu_enable), but the VideoCore and the DMA
+// engine access SDRAM through its uncached alias.
+#define DCACHE_LINE 64
+
+/*! Write the cache lines covering a buffer back to memory, before a bus master reads it */
+static void dcache_clean(const volatile void * buf, uint32_t len) {
+    for(uint32_t a=(uint32_t)buf & ~(DCACHE_LINE-1); a<(uint32_t)buf+len; a+=DCACHE_LINE) {
+        __asm__ __volatile__("mcr p15, 0, %0, c7, c10, 1" :: "r"(a) : "memory"); // DCCMVAC
+    }
+    __asm__ __volatile__("dsb" ::: "memory");
+}
+
+/*! Discard the cache lines covering a buffer, after a bus master has written it */
+static void dcache_invalidate(const volatile void * buf, uint32_t len) {
+    for(uint32_t a=(uint32_t)buf & ~(DCACHE_LINE-1); a<(uint32_t)buf+len; a+=DCACHE_LINE) {
+        __asm__ __volatile__("mcr p15, 0, %0, c7, c6, 1" :: "r"(a) : "memory"); // DCIMVAC
+    }
+    __asm__ __volatile__("dsb" ::: "memory");
+}
+#else
+// The data cache is not enabled
+static inline void dcache_clean(const volatile void * buf, uint32_t len) {
+}
+
+static inline void dcache_invalidate(const volatile void * buf, uint32_t len) {
+}
+#endif
+
+// BCM2835 mailbox property interface. The message buffer must be 16-byte aligned;
+// it fills a cache line of its own, since it is invalidated after the reply.
+volatile Mailbox_Registers * mailbox_registers = (Mailbox_Registers*)(BASE_BUS_ADDR + MAILBOX_REGISTERS_OFFSET);
+#define MBOX_MSG_WORDS 9
+static volatile uint32_t __attribute__((aligned(64))) mbox_msg[16];
+
+uint32_t clock_set_rate(uint32_t clock_id, uint32_t hz) {
+    mbox_msg[0] = MBOX_MSG_WORDS*4;     // message size
+    mbox_msg[1] = 0;                    // request
+    mbox_msg[2] = MBOX_TAG_SET_CLOCK_RATE;
+    mbox_msg[3] = 12;                   // value buffer size
+    mbox_msg[4] = 0;                    // request
+    mbox_msg[5] = clock_id;
+    mbox_msg[6] = hz;
+    mbox_msg[7] = 0;                    // skip setting turbo
+    mbox_msg[8] = 0;                    // end tag
+    uint32_t mail = (BUS_MEM_ALIAS | (uint32_t)mbox_msg) | MAILBOX_CH_PROPERTY;
+    dcache_clean(mbox_msg,sizeof(mbox_msg));
+    while(mailbox_registers->status & MAILBOX_FULL);
+    mailbox_registers->write = mail;
+    while(1) {
+        while(mailbox_registers->status & MAILBOX_EMPTY);
+        if(mailbox_registers->read==mail) {
+            break;
+        }
+    }
+    dcache_invalidate(mbox_msg,sizeof(mbox_msg));
+    return (mbox_msg[1]==0x80000000) ? mbox_msg[6] : 0;
+}
+
 // BCM2835 section 2.2 - Mini UART
 //    baudrate = (system_clock_freq) / (8 * ( baudrate_reg + 1 ) )
 //    baudrate * 8 * ( baudrate_reg + 1 ) = system_clock_freq
@@ -50,9 +166,199 @@ int gpio_write(unsigned int gpio, unsigned int level) {
 //    baudrate_reg = system_clock_freq / (baudrate * 8) - 1
 //    baudrate_reg = (system_clock_freq / (baudrate * 8)) - 1
 volatile uint32_t * aux_registers = (uint32_t *)(BASE_BUS_ADDR + AUX_REGISTERS_OFFSET);
-void uart_init(Baud baud) {
+
+// BCM2835 section 13 - PL011 UART
+//    BAUDDIV = (FUARTCLK/(16 * Baud rate)) = IBRD + FBRD/64
+volatile PL011_Registers * pl011_registers = (PL011_Registers*)(BASE_BUS_ADDR + PL011_REGISTERS_OFFSET);
+
+// UART ring buffers. These are only accessed in Supervisor- and IRQ-mode,
+// with interrupts disabled.
+#define UART_RX_SIZE 64   // must be a power of 2
+#define UART_TX_SIZE 1024 // must be a power of 2
+static struct {
+    uint32_t head;        // next byte to write
+    uint32_t tail;        // next byte to read
+    uint8_t buf[UART_RX_SIZE];
+} uart_rx;
+static struct {
+    uint32_t head;        // next byte to write
+    uint32_t tail;        // next byte to read
+    uint8_t buf[UART_TX_SIZE];
+} uart_tx;
+
+#ifdef CONSOLE_PL011
+
+// The DMA engine writes 32-bit words to the UART data register, so bytes are
+// staged one per word before being transmitted with DMA.
+#define UART_DMA_MAX 256
+static volatile DMA_Channel_Registers * uart_dma = (DMA_Channel_Registers*)
+    (BASE_BUS_ADDR + DMA_REGISTERS_OFFSET + sizeof(DMA_Channel_Registers)*UART_DMA_CHANNEL);
+static DMA_Control_Block uart_dma_cb;
+static uint32_t uart_dma_buf[UART_DMA_MAX];
+static bool uart_dma_active = false;
+
+static void uart_hw_init(Baud baud) {
+    pl011_registers->cr = 0;                // disable the UART
+    while(pl011_registers->fr & PL011_FR_BUSY);
+    pl011_registers->lcrh = 0;              // flush the FIFOs
+    gpio_set_func(14,GPF_ALT0);             // TXD0
+    gpio_set_func(15,GPF_ALT0);             // RXD0
+#ifdef CONSOLE_FLOW_CONTROL
+    gpio_set_func(16,GPF_ALT3);             // CTS0
+    gpio_set_func(17,GPF_ALT3);             // RTS0
+#endif
+
+    uint32_t clock = clock_set_rate(MBOX_CLOCK_UART,PL011_CLOCK_HZ);
+    if(!clock) {
+        clock = PL011_CLOCK_HZ;
+    }
+    uint32_t div = (4*clock + baud/2) / baud; // BAUDDIV * 64, rounded
+    pl011_registers->ibrd = div >> 6;
+    pl011_registers->fbrd = div & 0x3F;
+    pl011_registers->lcrh = PL011_LCRH_FEN | PL011_LCRH_WLEN8;
+    pl011_registers->ifls = PL011_IFLS_TX_1_8 | PL011_IFLS_RX_1_2;
+    pl011_registers->icr = 0x7FF;           // clear all interrupts
+    pl011_registers->imsc = PL011_INT_RX | PL011_INT_RT;
+    pl011_registers->dmacr = PL011_DMACR_TXDMAE;
+    pl011_registers->cr = PL011_CR_UARTEN | PL011_CR_TXE | PL011_CR_RXE
+#ifdef CONSOLE_FLOW_CONTROL
+                        | PL011_CR_RTSEN | PL011_CR_CTSEN
+#endif
+                        ;
+
+    *(volatile uint32_t *)(BASE_BUS_ADDR + DMA_ENABLE_OFFSET) |= (1<<UART_DMA_CHANNEL);
+    uart_dma->cs = DMA_CS_RESET;
+    uart_dma_active = false;
+
+    irq_registers->enable_irqs_2 = IRQ_2_UART;
+    irq_registers->enable_irqs_1 = IRQ_1_DMA(UART_DMA_CHANNEL);
+}
+
+static inline bool uart_hw_rx_ready() {
+    return !(pl011_registers->fr & PL011_FR_RXFE);
+}
+
+static inline uint8_t uart_hw_getc() {
+    return pl011_registers->dr & 0xFF;
+}
+
+static inline bool uart_hw_tx_ready() {
+    return !(pl011_registers->fr & PL011_FR_TXFF);
+}
+
+static inline void uart_hw_putc(uint8_t c) {
+    pl011_registers->dr = c;
+}
+
+static inline void uart_hw_enable_tx_irq(bool enable) {
+    uint32_t imsc = enable ? (pl011_registers->imsc | PL011_INT_TX) : (pl011_registers->imsc & ~PL011_INT_TX);
+    pl011_registers->imsc = imsc;
+}
+
+static inline bool uart_hw_tx_irq_enabled() {
+    return pl011_registers->imsc & PL011_INT_TX;
+}
+
+static inline void uart_hw_irq_ack() {
+    pl011_registers->icr = pl011_registers->mis;
+}
+
+bool uart_irq_pending() {
+    return (irq_registers->irq_pending_2 & IRQ_2_UART)
+        || (irq_registers->irq_pending_1 & IRQ_1_DMA(UART_DMA_CHANNEL));
+}
+
+/*! Transmit the next chunk of buffered data with DMA */
+static void uart_dma_start() {
+    uint32_t n = 0;
+    while(n<UART_DMA_MAX && uart_tx.head!=uart_tx.tail) {
+        uart_dma_buf[n++] = uart_tx.buf[uart_tx.tail++ & (UART_TX_SIZE-1)];
+    }
+    uart_dma_cb.ti = DMA_TI_INTEN | DMA_TI_WAIT_RESP | DMA_TI_DEST_DREQ | DMA_TI_SRC_INC
+                   | DMA_TI_PERMAP(DMA_PERMAP_UART_TX);
+    uart_dma_cb.source_ad = BUS_MEM_ALIAS | (uint32_t)uart_dma_buf;
+    uart_dma_cb.dest_ad = BUS_PERIPH_ADDR + PL011_REGISTERS_OFFSET; // data register
+    uart_dma_cb.txfr_len = n * sizeof(uint32_t);
+    uart_dma_cb.stride = 0;
+    uart_dma_cb.nextconbk = 0;
+    dcache_clean(uart_dma_buf,n * sizeof(uint32_t));
+    dcache_clean(&uart_dma_cb,sizeof(uart_dma_cb));
+    uart_dma_active = true;
+    uart_dma->conblk_ad = BUS_MEM_ALIAS | (uint32_t)&uart_dma_cb;
+    uart_dma->cs = DMA_CS_ACTIVE;
+}
+
+/*! Handle DMA completion. Returns true if a transfer has completed */
+static bool uart_dma_done() {
+    if(!uart_dma_active || !(uart_dma->cs & DMA_CS_END)) {
+        return false;
+    }
+    uart_dma->cs = DMA_CS_END | DMA_CS_INT;
+    uart_dma_active = false;
+    return true;
+}
+
+#else // mini UART
+
+static uint32_t uart_ier = 0; // Current value of AUX_MU_IER_REG
+
+static void uart_hw_init(Baud baud) {
     gpio_set_func(14,GPF_ALT5);
     gpio_set_func(15,GPF_ALT5);
+
+    aux_registers[AUX_ENABLES] = 1;         // enable the mini-uart 
+    aux_registers[AUX_MU_CNTL_REG] = 0;     // disable tx/rx 
+    aux_registers[AUX_MU_IER_REG] = 0;      // disable tx/rx interrupts (for now)
+    aux_registers[AUX_MU_LCR_REG] = 3;      // 8-bit mode
+    aux_registers[AUX_MU_MCR_REG] = 0;
+    aux_registers[AUX_MU_IIR_REG] = 0xC6;   // clear the tx/rx FIFOs
+    aux_registers[AUX_MU_BAUD_REG] = ((CORE_CLOCK_HZ/4)/baud + 1)/2 - 1; // 270 for 115200
+    aux_registers[AUX_MU_CNTL_REG] = 3;     // enable tx/rx 
+
+    uart_ier = AUX_MU_IER_RX;
+    aux_registers[AUX_MU_IER_REG] = uart_ier; // enable rx interrupts
+    irq_registers->enable_irqs_1 = IRQ_1_AUX;
+}
+
+static inline bool uart_hw_rx_ready() {
+    return aux_registers[AUX_MU_LSR_REG] & AUX_MU_LSR_DATA_READY;
+}
+
+static inline uint8_t uart_hw_getc() {
+    return aux_registers[AUX_MU_IO_REG] & 0xFF;
+}
+
+static inline bool uart_hw_tx_ready() {
+    return aux_registers[AUX_MU_LSR_REG] & AUX_MU_LSR_TX_EMPTY;
+}
+
+static inline void uart_hw_putc(uint8_t c) {
+    aux_registers[AUX_MU_IO_REG] = c;
+}
+
+static inline void uart_hw_enable_tx_irq(bool enable) {
+    uint32_t ier = enable ? (uart_ier | AUX_MU_IER_TX) : (uart_ier & ~AUX_MU_IER_TX);
+    if(ier!=uart_ier) {
+        uart_ier = ier;
+        aux_registers[AUX_MU_IER_REG] = uart_ier;
+    }
+}
+
+static inline bool uart_hw_tx_irq_enabled() {
+    return uart_ier & AUX_MU_IER_TX;
+}
+
+static inline void uart_hw_irq_ack() {
+    // Mini UART interrupts are cleared by reading/writing the FIFOs
+}
+
+bool uart_irq_pending() {
+    return irq_registers->irq_pending_1 & IRQ_1_AUX;
+}
+
+#endif // CONSOLE_PL011
+
+void uart_init(Baud baud) {
     // See BCM2835 - Table 6-28 synopsis
     gpio_registers->pud = GPPUD_OFF;
     busywait(150);
@@ -60,24 +366,48 @@ void uart_init(Baud baud) {
     busywait(150);
     gpio_registers->pudclk[0] = 0;
 
-    aux_registers[AUX_ENABLES] = 1;         // enable the mini-uart 
-    aux_registers[AUX_MU_CNTL_REG] = 0;     // disable tx/rx 
-    aux_registers[AUX_MU_IER_REG] = 0;      // disable tx/rx interrupts (not now)
-    aux_registers[AUX_MU_LCR_REG] = 3;      // 8-bit mode
-    aux_registers[AUX_MU_MCR_REG] = 0;
-    aux_registers[AUX_MU_BAUD_REG] = 270;   // Set baud rate to 115200
-    aux_registers[AUX_MU_CNTL_REG] = 3;     // enable tx/rx 
+    uart_rx.head = uart_rx.tail = 0;
+    uart_tx.head = uart_tx.tail = 0;
+    uart_hw_init(baud);
+}
+
+/*! Start (or continue) transmitting buffered data */
+static void uart_tx_start() {
+#ifdef CONSOLE_PL011
+    if(uart_dma_active) {
+        // DMA completion will continue with the rest
+        return;
+    }
+    if(uart_tx.head-uart_tx.tail>=UART_DMA_MIN) {
+        uart_hw_enable_tx_irq(false);
+        uart_dma_start();
+        return;
+    }
+#endif
+    // Fill the FIFO; the TX interrupt refills it as it drains
+    while(uart_tx.head!=uart_tx.tail && uart_hw_tx_ready()) {
+        uart_hw_putc(uart_tx.buf[uart_tx.tail++ & (UART_TX_SIZE-1)]);
+    }
+    uart_hw_enable_tx_irq(uart_tx.head!=uart_tx.tail);
+}
+
+/*! Write a byte directly to the UART, waiting until it can accept data */
+static void uart_put_polled(uint8_t c) {
+    while(!uart_hw_tx_ready());
+    uart_hw_putc(c);
 }
 
 void uart_putc(uint8_t c) {
-    // wait until device is ready to accept data
-    while(1) {
-        volatile uint32_t val = aux_registers[AUX_MU_LSR_REG];
-        if(val & 0x20) {
-            break;
-        }
+    if(uart_tx.head-uart_tx.tail==UART_TX_SIZE) {
+        // Buffer is full; make room by sending the oldest byte ourselves
+#ifdef CONSOLE_PL011
+        // (after any DMA transfer has completed, to keep the output in order)
+        while(uart_dma_active && !uart_dma_done());
+#endif
+        uart_put_polled(uart_tx.buf[uart_tx.tail++ & (UART_TX_SIZE-1)]);
     }
-    aux_registers[AUX_MU_IO_REG] = c;
+    uart_tx.buf[uart_tx.head++ & (UART_TX_SIZE-1)] = c;
+    uart_tx_start();
 }
 
 void uart_puts(const char * str) {
@@ -87,25 +417,86 @@ void uart_puts(const char * str) {
 }
 
 void uart_putn(int val) {
-    char buff[19];
-    itoa(val,buff,10);
-    uart_puts(buff);
+    kprintf("%d",val);
 }
 
 uint8_t uart_getc() {
-    while(1) {
-        volatile uint32_t val = aux_registers[AUX_MU_LSR_REG];
-        if(val & 0x01) {
-            break;
+    if(uart_rx.head!=uart_rx.tail) {
+        return uart_rx.buf[uart_rx.tail++ & (UART_RX_SIZE-1)];
+    }
+    while(!uart_hw_rx_ready());
+    return uart_hw_getc();
+}
+
+uint32_t uart_read(uint8_t * buf, uint32_t len) {
+    uint32_t n = 0;
+    while(n<len && uart_rx.head!=uart_rx.tail) {
+        buf[n++] = uart_rx.buf[uart_rx.tail++ & (UART_RX_SIZE-1)];
+    }
+    return n;
+}
+
+uint32_t uart_rx_count(void) {
+    return uart_rx.head-uart_rx.tail;
+}
+
+uint32_t uart_write(const uint8_t * buf, uint32_t len) {
+    uint32_t n = 0;
+    while(n<len && uart_tx.head-uart_tx.tail<UART_TX_SIZE) {
+        uart_tx.buf[uart_tx.head++ & (UART_TX_SIZE-1)] = buf[n++];
+    }
+    if(n>0) {
+        uart_tx_start();
+    }
+    return n;
+}
+
+uint32_t uart_irq() {
+    uint32_t events = 0;
+    uart_hw_irq_ack();
+    // Receive; drop data if the buffer is full
+    while(uart_hw_rx_ready()) {
+        uint8_t c = uart_hw_getc();
+        if(uart_rx.head-uart_rx.tail<UART_RX_SIZE) {
+            uart_rx.buf[uart_rx.head++ & (UART_RX_SIZE-1)] = c;
         }
+        events |= UART_RX;
     }
-    return aux_registers[AUX_MU_IO_REG] & 0xFF;
+    // Transmit; continue with the buffered data
+#ifdef CONSOLE_PL011
+    if(uart_dma_done()) {
+        events |= UART_TX;
+        uart_tx_start();
+    }
+#endif
+    if(uart_hw_tx_irq_enabled()) {
+        uint32_t tail = uart_tx.tail;
+        uart_tx_start();
+        if(uart_tx.tail!=tail) {
+            events |= UART_TX;
+        }
+    }
+    return events;
 }
 
+void uart_flush() {
+#ifdef CONSOLE_PL011
+    while(uart_dma_active && !uart_dma_done());
+#endif
+    while(uart_tx.head!=uart_tx.tail) {
+        uart_put_polled(uart_tx.buf[uart_tx.tail++ & (UART_TX_SIZE-1)]);
+    }
+}
+
+// CHI works as the sequence count of a seqlock: if it changed while CLO was
+// read, CLO wrapped, and the read is retried.
 static inline uint64_t cur_time_micros(void) {
-    uint64_t timer = system_timer_registers->chi;
-    timer = (timer<<32) + system_timer_registers->clo;
-    return timer;
+    uint32_t hi, lo;
+    do {
+        hi = system_timer_registers->chi;
+        lo = system_timer_registers->clo;
+    } while(hi!=system_timer_registers->chi);
+    return ((uint64_t)hi<<32) | lo;
 }
 
 // Return system timer microseconds
@@ -113,6 +504,165 @@ uint64_t system_timer(void) {
     return cur_time_micros();
 }
 
+// User-mode clock (see toast.h); reading the System Timer doesn't trap. Without
+// the MMU (rpi1, and single-core builds) all memory is readable in User-mode;
+// SMP builds map the timer's section read-only for User-mode (see mmu_init).
+uint64_t toast_now_us(void) {
+    return cur_time_micros();
+}
+
+uint64_t toast_now_ms(void) {
+    return udiv1000_u64(cur_time_micros());
+}
+
+// ARM1176 Performance Monitor Control Register (ARM1176JZF-S TRM 3.2.51)
+#define PMNC_ENABLE      0b001 // Enable all counters
+#define PMNC_RESET_PMN   0b010 // Reset count registers
+#define PMNC_RESET_CCNT  0b100 // Reset cycle counter
+#define PMNC_EVT0_SHIFT  20    // Event counted by count register 0
+#define PMNC_EVT1_SHIFT  12    // Event counted by count register 1
+
+#ifndef CYCLE_COUNTER_SYSTEM_TIMER
+void cycle_counter_init(void) {
+    uint32_t pmnc = PMNC_ENABLE | PMNC_RESET_PMN | PMNC_RESET_CCNT;
+    __asm__ __volatile__("mcr p15, 0, %0, c15, c12, 0" : : "r"(pmnc));
+}
+
+uint32_t cycle_counter(void) {
+    uint32_t cycles;
+    __asm__ __volatile__("mrc p15, 0, %0, c15, c12, 1" : "=r"(cycles));
+    return cycles;
+}
+
+void pmu_select(uint32_t evt0, uint32_t evt1) {
+    // Leave the cycle counter running; it is shared with the tracer and SWI statistics
+    uint32_t pmnc = PMNC_ENABLE | PMNC_RESET_PMN
+                  | ((evt0 & 0xFF) << PMNC_EVT0_SHIFT)
+                  | ((evt1 & 0xFF) << PMNC_EVT1_SHIFT);
+    __asm__ __volatile__("mcr p15, 0, %0, c15, c12, 0" : : "r"(pmnc));
+}
+
+void pmu_read(uint32_t * evt0, uint32_t * evt1) {
+    uint32_t count;
+    __asm__ __volatile__("mrc p15, 0, %0, c15, c12, 2" : "=r"(count));
+    *evt0 = count;
+    __asm__ __volatile__("mrc p15, 0, %0, c15, c12, 3" : "=r"(count));
+    *evt1 = count;
+}
+#else
+// For emulators without the ARM1176 performance monitor (e.g. QEMU):
+// derive "cycles" from the 1MHz system timer
+void cycle_counter_init(void) {
+}
+
+uint32_t cycle_counter(void) {
+    return cur_time_micros() * (CPU_CLOCK_HZ/1000000);
+}
+
+void pmu_select(uint32_t evt0, uint32_t evt1) {
+}
+
+void pmu_read(uint32_t * evt0, uint32_t * evt1) {
+    *evt0 = 0;
+    *evt1 = 0;
+}
+#endif
+
+extern uint32_t swi_addr; // The SWI vector's handler address (see start.S)
+void swi_handler(void);
+void swi_handler_baseline(void);
+
+void swi_entry_select(bool baseline) {
+    // Patch the copy of the exception vector at 0, made at reset from the one at 0x8000
+    volatile uint32_t * vector = (volatile uint32_t *)((uint32_t)&swi_addr - 0x8000);
+    *vector = (uint32_t)(baseline ? swi_handler_baseline : swi_handler);
+}
+
+void cpu_idle(void) {
+#ifdef BOARD_RPI2
+    // ARMv7 allows wait-for-interrupt in User-mode; idle cores sleep until a tick or IPI
+    __asm__ __volatile__("wfi");
+#else
+    // Called in User-mode, so can't wait-for-interrupt; just let the idle process spin
+#endif
+}
+
+#if SMP_CPUS>1
+volatile Local_Registers * local_registers = (Local_Registers*)LOCAL_REGISTERS_ADDR;
+
+// Flat (virtual==physical) translation table of 1MB sections, for the caches and the
+// kernel lock (see mmu_enable). ARMv7 short-descriptor section entries:
+#define SECTION        0b10         // Section descriptor
+#define SECTION_B      (1<<2)
+#define SECTION_C      (1<<3)
+#define SECTION_XN     (1<<4)       // Execute-never
+#define SECTION_AP_RW  (0b11<<10)   // Read/write, at any privilege level
+#define SECTION_AP_PRIV (0b01<<10)  // Read/write in privileged modes; no User-mode access
+#define SECTION_AP_USER_RO (0b10<<10) // Read/write in privileged modes; read-only in User-mode
+#define SECTION_TEX(t) ((t)<<12)
+#define SECTION_S      (1<<16)      // Shareable
+#define SECTION_RAM    (SECTION | SECTION_AP_RW | SECTION_TEX(1) | SECTION_C | SECTION_B | SECTION_S) // Write-back, write-allocate
+#define SECTION_DEVICE (SECTION | SECTION_B | SECTION_XN) // Shareable device, with SECTION_AP_*
+#define RAM_SECTIONS   (BASE_BUS_ADDR >> 20) // SDRAM, up to the peripherals
+// The System Timer's section, read by toast_now_us in User-mode. The section also holds the
+// interrupt controller and the VideoCore mailbox, which User-mode can read but not write.
+#define TIMER_SECTION  ((BASE_BUS_ADDR + SYSTEM_TIMER_OFFSET) >> 20)
+
+static uint32_t __attribute__((aligned(16384))) mmu_table[4096];
+
+void mmu_init(void) {
+    for(uint32_t i=0; i<4096; i++) {
+        mmu_table[i] = (i << 20) | (i<RAM_SECTIONS ? SECTION_RAM
+                                  : i==TIMER_SECTION ? SECTION_DEVICE | SECTION_AP_USER_RO
+                                  : SECTION_DEVICE | SECTION_AP_PRIV);
+    }
+    __asm__ __volatile__("dsb" ::: "memory");
+    mmu_enable();
+}
+
+void mmu_enable(void) {
+    uint32_t r;
+    // Take part in the coherency of the other cores' data caches (ACTLR.SMP), before enabling ours
+    __asm__ __volatile__("mrc p15, 0, %0, c1, c0, 1" : "=r"(r));
+    __asm__ __volatile__("mcr p15, 0, %0, c1, c0, 1" :: "r"(r | (1<<6)));
+    __asm__ __volatile__("mcr p15, 0, %0, c2, c0, 2" :: "r"(0));   // TTBCR: TTBR0 only
+    // TTBR0: table walks are inner and outer write-back, write-allocate, shareable
+    __asm__ __volatile__("mcr p15, 0, %0, c2, c0, 0" :: "r"((uint32_t)mmu_table | 0x4A));
+    __asm__ __volatile__("mcr p15, 0, %0, c3, c0, 0" :: "r"(0x55555555)); // DACR: all domains are clients
+    __asm__ __volatile__("mcr p15, 0, %0, c8, c7, 0" :: "r"(0));   // Invalidate the TLBs
+    __asm__ __volatile__("mcr p15, 0, %0, c7, c5, 0" :: "r"(0));   // Invalidate the instruction cache
+    __asm__ __volatile__("dsb\n\tisb" ::: "memory");
+    // SCTLR: MMU, data cache, branch prediction and instruction cache
+    __asm__ __volatile__("mrc p15, 0, %0, c1, c0, 0" : "=r"(r));
+    r |= (1<<0) | (1<<2) | (1<<11) | (1<<12);
+    __asm__ __volatile__("mcr p15, 0, %0, c1, c0, 0\n\tisb" :: "r"(r) : "memory");
+}
+
+void smp_start(void (*entry)(void)) {
+    for(uint32_t cpu=1; cpu<SMP_CPUS; cpu++) {
+        local_registers->core_mbox_set[cpu][MBOX_BOOT] = (uint32_t)entry;
+    }
+    __asm__ __volatile__("dsb\n\tsev");
+}
+
+void ipi_init(void) {
+    local_registers->core_mbox_irq_control[cpu_id()] = 1<<MBOX_IPI;
+}
+
+void ipi_send(uint32_t cpu) {
+    local_registers->core_mbox_set[cpu][MBOX_IPI] = 1;
+}
+
+bool ipi_irq(void) {
+    uint32_t cpu = cpu_id();
+    if(!(local_registers->core_irq_source[cpu] & CORE_IRQ_MBOX(MBOX_IPI))) {
+        return false;
+    }
+    local_registers->core_mbox_clr[cpu][MBOX_IPI] = 0xFFFFFFFF;
+    return true;
+}
+#endif
+
 uint32_t busy_wait_millis(uint32_t millis) {
     uint64_t deadline = system_timer() + (millis*1000);
     while(cur_time_micros()<deadline);
@@ -120,12 +670,12 @@ uint32_t busy_wait_millis(uint32_t millis) {
 }
 
 void panic(int code) {
-    char buff[8];
-    uart_puts("\033[31;1m");
-    uart_puts("panic: code=");
-    uart_puts(itoa(code,buff,10));
-    uart_puts("\033[0m");
-    uart_puts("\r\n");
+    klog_flush();
+    kprintf("\033[31;1mpanic: code=%d\033[0m\r\n",code);
+    uart_flush();
+    if(TRACE_ENABLED && TRACE_FLIGHT_RECORDER) {
+        trace_dump();
+    }
     gpio_set_func(SYS_LED_BLUE,GPF_OUTPUT);
     while(1) {
         for(int i=0;i<code;i++) {
@@ -3,6 +3,7 @@
 #define __BCM2835_H__
 
 #include <stdint.h>
+#include <stdbool.h>
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
@@ -17,7 +18,34 @@
 // bus address range starting at 0x7E000000.
 
 // The base bus address on the Raspberry Pi 1 is actually 0x20000000
+// (0x3F000000 on the BCM2836/BCM2837 of the Raspberry Pi 2 and 3)
+#ifdef BOARD_RPI2
+#define BASE_BUS_ADDR 0x3F000000UL  // RPi-2/3
+#else
 #define BASE_BUS_ADDR 0x20000000UL  // RPi-1
+#endif
+
+// Addresses as seen by the VideoCore and the DMA engine (1.2.4 Bus addresses)
+#define BUS_PERIPH_ADDR 0x7E000000UL  // Peripherals
+#ifdef BOARD_RPI2
+#define BUS_MEM_ALIAS   0xC0000000UL  // RPi-2/3: uncached alias of SDRAM
+#else
+#define BUS_MEM_ALIAS   0x40000000UL  // RPi-1: L2 cache-coherent alias of SDRAM
+#endif
+
+// Clock frequency of the VideoCore core clock; this drives the mini UART
+#define CORE_CLOCK_HZ 250000000UL
+// Clock frequency of the ARM core (board default); this drives the cycle counter
+#ifdef BOARD_RPI2
+#define CPU_CLOCK_HZ 900000000UL    // Cortex-A7
+#else
+#define CPU_CLOCK_HZ 700000000UL    // ARM1176
+#endif
+
+// Number of cores the kernel schedules on (BCM2836/BCM2837: up to 4)
+#ifndef SMP_CPUS
+#define SMP_CPUS 1
+#endif
 
 // BCM2835 ARM Peripherals: Section 7, Interrupts
 #define IRQ_REGISTERS_OFFSET 0x0000B200UL
@@ -43,6 +71,14 @@ volatile typedef struct {
 #define IRQ_ILLEGAL_ACCESS_1 0b01000000
 #define IRQ_ILLEGAL_ACCESS_2 0b10000000
 
+// IRQ pending/enable 1 bits (IRQs 0-31)
+#define IRQ_1_DMA(channel)   (1<<(16+(channel))) // DMA channel 0-12
+#define IRQ_1_AUX            (1<<29) // Auxiliary peripherals (mini UART)
+
+// IRQ pending/enable 2 bits (IRQs 32-63)
+#define IRQ_2_UART           (1<<(57-32)) // PL011 UART
+#define IRQ_2_GPIO           (1<<(52-32)) // Any GPIO event (gpio_int[3])
+
 // BCM2835 ARM Peripherals: Section 12, SYstem Timer
 #define SYSTEM_TIMER_OFFSET 0x00003000UL
 volatile typedef struct {
@@ -112,6 +148,8 @@ volatile typedef struct {
 
 // Valid GPIO lines are [0,GPIO_MAX)
 #define GPIO_MAX 54
+// GPIO lines are in two banks of 32 (set, clr, lev, ... registers)
+#define GPIO_BANKS 2
 
 // Valid GP function/modes [0,GPF_MAX)
 #define GPF_INPUT  0b000
@@ -144,24 +182,199 @@ volatile typedef struct {
 #define AUX_MU_STAT_REG 25 // Mini Uart Extra Status - 32 bits
 #define AUX_MU_BAUD_REG 26 // Mini Uart Baudrate - 16 bits
 
+// Mini UART interrupt enable bits (AUX_MU_IER_REG)
+// NOTE: see BCM2835 errata; bits 1:0 are swapped in the datasheet, and
+// bits 3:2 must also be set in order to receive interrupts.
+#define AUX_MU_IER_RX   0b0101 // Enable receive interrupt
+#define AUX_MU_IER_TX   0b1010 // Enable transmit interrupt
+
+// Mini UART line status bits (AUX_MU_LSR_REG)
+#define AUX_MU_LSR_DATA_READY 0x01 // Receive FIFO holds at least one byte
+#define AUX_MU_LSR_TX_EMPTY   0x20 // Transmit FIFO can accept at least one byte
+
+// BCM2835 ARM Peripherals: Section 13, UART (ARM PrimeCell PL011)
+#define PL011_REGISTERS_OFFSET 0x00201000UL
+volatile typedef struct {
+    uint32_t dr;        // Data Register
+    uint32_t rsrecr;    // Receive status / error clear
+    uint32_t resv1[4];  // reserved
+    uint32_t fr;        // Flag register
+    uint32_t resv2;     // reserved
+    uint32_t ilpr;      // not in use
+    uint32_t ibrd;      // Integer Baud rate divisor
+    uint32_t fbrd;      // Fractional Baud rate divisor
+    uint32_t lcrh;      // Line Control register
+    uint32_t cr;        // Control register
+    uint32_t ifls;      // Interrupt FIFO Level Select Register
+    uint32_t imsc;      // Interrupt Mask Set Clear Register
+    uint32_t ris;       // Raw Interrupt Status Register
+    uint32_t mis;       // Masked Interrupt Status Register
+    uint32_t icr;       // Interrupt Clear Register
+    uint32_t dmacr;     // DMA Control Register
+} PL011_Registers;
+
+#define PL011_FR_RXFE     (1<<4)  // Receive FIFO empty
+#define PL011_FR_TXFF     (1<<5)  // Transmit FIFO full
+#define PL011_FR_BUSY     (1<<3)  // UART busy transmitting data
+#define PL011_LCRH_FEN    (1<<4)  // Enable FIFOs
+#define PL011_LCRH_WLEN8  (3<<5)  // 8-bit words
+#define PL011_CR_UARTEN   (1<<0)  // UART enable
+#define PL011_CR_TXE      (1<<8)  // Transmit enable
+#define PL011_CR_RXE      (1<<9)  // Receive enable
+#define PL011_CR_RTSEN    (1<<14) // RTS hardware flow control enable
+#define PL011_CR_CTSEN    (1<<15) // CTS hardware flow control enable
+#define PL011_IFLS_TX_1_8 (0<<0)  // Transmit interrupt when FIFO <= 1/8 full
+#define PL011_IFLS_RX_1_2 (2<<3)  // Receive interrupt when FIFO >= 1/2 full
+#define PL011_INT_RX      (1<<4)  // Receive interrupt
+#define PL011_INT_TX      (1<<5)  // Transmit interrupt
+#define PL011_INT_RT      (1<<6)  // Receive timeout interrupt
+#define PL011_DMACR_TXDMAE (1<<1) // Transmit DMA enable
+
+// UART reference clock. The firmware default (3MHz) limits the baud rate
+// to 187500; 48MHz allows up to 3Mbaud.
+#ifndef PL011_CLOCK_HZ
+#define PL011_CLOCK_HZ 48000000UL
+#endif
+
+// BCM2835 ARM Peripherals: Section 4, DMA Controller
+#define DMA_REGISTERS_OFFSET 0x00007000UL
+volatile typedef struct {
+    uint32_t cs;        // Control and Status
+    uint32_t conblk_ad; // Control Block Address
+    uint32_t ti;        // Transfer Information (from control block)
+    uint32_t source_ad; // Source Address (from control block)
+    uint32_t dest_ad;   // Destination Address (from control block)
+    uint32_t txfr_len;  // Transfer Length (from control block)
+    uint32_t stride;    // 2D Stride (from control block)
+    uint32_t nextconbk; // Next Control Block Address (from control block)
+    uint32_t debug;     // Debug
+    uint32_t resv[55];  // pad to 0x100
+} DMA_Channel_Registers;
+#define DMA_ENABLE_OFFSET 0x00007FF0UL
+
+typedef struct {
+    uint32_t ti;        // Transfer Information
+    uint32_t source_ad; // Source Address
+    uint32_t dest_ad;   // Destination Address
+    uint32_t txfr_len;  // Transfer Length
+    uint32_t stride;    // 2D Stride
+    uint32_t nextconbk; // Next Control Block Address
+    uint32_t resv[2];   // reserved
+} __attribute__((aligned(32))) DMA_Control_Block;
+
+#define DMA_CS_ACTIVE      (1<<0)   // Activate the DMA
+#define DMA_CS_END         (1<<1)   // DMA end flag (write 1 to clear)
+#define DMA_CS_INT         (1<<2)   // Interrupt status (write 1 to clear)
+#define DMA_CS_RESET       (1<<31)  // DMA channel reset
+#define DMA_TI_INTEN       (1<<0)   // Interrupt enable
+#define DMA_TI_WAIT_RESP   (1<<3)   // Wait for write response
+#define DMA_TI_DEST_DREQ   (1<<6)   // Control destination writes with DREQ
+#define DMA_TI_SRC_INC     (1<<8)   // Source address increment
+#define DMA_TI_PERMAP(p)   ((p)<<16) // Peripheral mapping
+#define DMA_PERMAP_UART_TX 12
+
+// DMA channel used for UART transmit
+#define UART_DMA_CHANNEL 5
+// Minimum number of buffered bytes worth transmitting with DMA
+#define UART_DMA_MIN     64
+
+// BCM2835 mailbox (VideoCore property interface)
+#define MAILBOX_REGISTERS_OFFSET 0x0000B880UL
+volatile typedef struct {
+    uint32_t read;
+    uint32_t resv1[3];
+    uint32_t peek;
+    uint32_t sender;
+    uint32_t status;
+    uint32_t config;
+    uint32_t write;
+} Mailbox_Registers;
+
+#define MAILBOX_FULL           0x80000000
+#define MAILBOX_EMPTY          0x40000000
+#define MAILBOX_CH_PROPERTY    8
+#define MBOX_TAG_SET_CLOCK_RATE 0x00038002
+#define MBOX_CLOCK_UART        2
+
+/*! Set the rate of a VideoCore clock. Returns the new rate, or 0 on failure */
+uint32_t clock_set_rate(uint32_t clock_id, uint32_t hz);
+
 int gpio_set_func(unsigned int gpio, unsigned func);
 int gpio_write(unsigned int gpio, unsigned int level);
+/*! Set, then clear, the outputs selected by the masks in one GPIO bank */
+int gpio_write_mask(unsigned int bank, uint32_t set_mask, uint32_t clr_mask);
+/*! Read the levels of the GPIO lines in one bank */
+uint32_t gpio_read_bank(unsigned int bank);
+
+// GPIO event detection (same values as GPIO_EVT_* in toast.h)
+#define GPIO_EVT_RISING        0b000001 // Rising edge (eren)
+#define GPIO_EVT_FALLING       0b000010 // Falling edge (efen)
+#define GPIO_EVT_HIGH          0b000100 // High level (hen)
+#define GPIO_EVT_LOW           0b001000 // Low level (len)
+#define GPIO_EVT_ASYNC_RISING  0b010000 // Asynchronous rising edge (aren)
+#define GPIO_EVT_ASYNC_FALLING 0b100000 // Asynchronous falling edge (afen)
+#define GPIO_EVT_LEVEL         (GPIO_EVT_HIGH|GPIO_EVT_LOW)
+
+/*! Select the events detected on a GPIO line (0 disables detection), and clear its event status */
+int gpio_irq_config(unsigned int gpio, unsigned int events);
+/*! Returns true if there is a GPIO event interrupt pending */
+bool gpio_irq_pending();
+/*! Returns, and clears, the detected events of GPIO bank 0.
+ *
+ * Level detection is disabled for lines with a detected event, since the
+ * level would otherwise keep raising the interrupt; re-enable it with
+ * gpio_irq_config.
+ */
+uint32_t gpio_irq();
 
 typedef enum Baud_E {
-    BAUD_115200=115200
+    BAUD_115200=115200,
+    BAUD_230400=230400,
+    BAUD_460800=460800,
+    BAUD_921600=921600,
+    BAUD_1000000=1000000,
+    BAUD_1500000=1500000,
+    BAUD_2000000=2000000,
+    BAUD_3000000=3000000,
 } Baud;
 
+// The console UART is the mini UART, unless built with CONSOLE_PL011.
+// The PL011 has deeper FIFOs, a configurable clock, hardware flow control
+// (CONSOLE_FLOW_CONTROL) and DMA-backed transmit.
+#ifndef CONSOLE_BAUD
+#define CONSOLE_BAUD BAUD_115200
+#endif
+
 void uart_init(Baud baud);
 void uart_putc(uint8_t ch);
 void uart_puts(const char * str);
 void uart_putn(int n);
 uint8_t uart_getc();
 
+// UART events reported by uart_irq
+#define UART_RX 0b00000001 // Data has been received
+#define UART_TX 0b00000010 // Space is available in the transmit buffer
+
+/*! Read up to len buffered bytes, without blocking. Returns the number of bytes read */
+uint32_t uart_read(uint8_t * buf, uint32_t len);
+/*! Returns the number of received bytes that are buffered */
+uint32_t uart_rx_count(void);
+/*! Buffer up to len bytes for transmission, without blocking. Returns the number of bytes buffered */
+uint32_t uart_write(const uint8_t * buf, uint32_t len);
+/*! Returns true if the console UART has raised an interrupt */
+bool uart_irq_pending();
+/*! Handle the console UART interrupt. Returns UART_RX/UART_TX events */
+uint32_t uart_irq();
+/*! Transmit all buffered data, polling the UART (for use with interrupts disabled) */
+void uart_flush();
+
 extern volatile IRQ_Registers * irq_registers;
 extern volatile System_Timer_Registers * system_timer_registers;
 extern volatile Timer_Registers * timer_registers;
 extern volatile GPIO_Registers * gpio_registers;
 extern volatile uint32_t * aux_registers;
+extern volatile PL011_Registers * pl011_registers;
+extern volatile Mailbox_Registers * mailbox_registers;
 
 #define SYS_LED_BLUE     22
 #define SYS_LED_RED      23
@@ -171,6 +384,15 @@ extern volatile uint32_t * aux_registers;
 
 uint64_t system_timer(void);
 
+/*! Enable (and reset) the ARM1176 cycle counter */
+void cycle_counter_init(void);
+/*! Read the ARM1176 cycle counter (Supervisor- or IRQ-mode only) */
+uint32_t cycle_counter(void);
+/*! Select the events counted by the two ARM1176 event count registers (and reset them) */
+void pmu_select(uint32_t evt0, uint32_t evt1);
+/*! Read the two ARM1176 event count registers (Supervisor- or IRQ-mode only) */
+void pmu_read(uint32_t * evt0, uint32_t * evt1);
+
 enum Panic_Code {
     FC_HANG = 1,
     FC_ILLEGAL_ARG,
@@ -186,10 +408,87 @@ enum Panic_Code {
     FC_OUT_OF_MON,
     FC_INVALID_MON_STATE,
     FC_ALREADY_INITIALIZED,
+    FC_OUT_OF_SEM,
+    FC_OUT_OF_EVT,
+    FC_OUT_OF_TIMER,
 };
 
 void panic(int code);
 
+/*! Called by the idle process; waits for the next interrupt */
+void cpu_idle(void);
+
+/*! Point the SWI vector at swi_handler_baseline, or back at swi_handler (see sys_entry_baseline) */
+void swi_entry_select(bool baseline);
+
+/*! Returns the number of the core this is running on */
+static inline uint32_t cpu_id(void) {
+#if SMP_CPUS>1
+    uint32_t mpidr;
+    __asm__ __volatile__("mrc p15, 0, %0, c0, c0, 5" : "=r"(mpidr)); // Multiprocessor Affinity Register
+    return mpidr & 3;
+#else
+    return 0;
+#endif
+}
+
+#if SMP_CPUS>1
+// See: BCM2836 ARM-local peripherals (QA7)
+//  https://www.raspberrypi.org/documentation/hardware/raspberrypi/bcm2836/QA7_rev3.4.pdf
+#define LOCAL_REGISTERS_ADDR 0x40000000UL
+volatile typedef struct {
+    uint32_t control;
+    uint32_t reserved_1;
+    uint32_t core_timer_prescaler;
+    uint32_t gpu_irq_routing;
+    uint32_t pmu_irq_routing_set;
+    uint32_t pmu_irq_routing_clr;
+    uint32_t reserved_2;
+    uint32_t core_timer_ls;
+    uint32_t core_timer_ms;
+    uint32_t local_irq_routing;
+    uint32_t reserved_3;
+    uint32_t axi_counters;
+    uint32_t axi_irq;
+    uint32_t local_timer_control;
+    uint32_t local_timer_flags;
+    uint32_t reserved_4;
+    uint32_t core_timer_irq_control[4];
+    uint32_t core_mbox_irq_control[4];
+    uint32_t core_irq_source[4];
+    uint32_t core_fiq_source[4];
+    uint32_t core_mbox_set[4][4];      // Write-set: [core][mailbox]
+    uint32_t core_mbox_clr[4][4];      // Read, and write-clear: [core][mailbox]
+} Local_Registers;
+
+#define CORE_IRQ_MBOX(mbox) (1<<(4+(mbox))) // core_irq_source: mailbox 0-3
+#define CORE_IRQ_GPU        (1<<8)          // core_irq_source: GPU interrupt (routed to one core)
+
+// Mailbox usage
+#define MBOX_IPI  0 // Inter-processor interrupts
+#define MBOX_BOOT 3 // Secondary core entry point (firmware/QEMU boot stub)
+
+extern volatile Local_Registers * local_registers;
+
+/*! Build the flat translation table, and enable the MMU and caches on core 0 (before the first kernel_lock) */
+void mmu_init(void);
+/*! Enable the MMU and caches on the calling core, with the table built by mmu_init.
+ *
+ * The kernel lock relies on the exclusive monitor, which only works on
+ * normal (cacheable) memory; SDRAM is normal, write-back memory, shared by
+ * the cores, and the peripherals are device memory.
+ */
+void mmu_enable(void);
+/*! Start the secondary cores at entry (they are parked by the boot stub) */
+void smp_start(void (*entry)(void));
+/*! Enable inter-processor interrupts on the calling core */
+void ipi_init(void);
+/*! Interrupt the given core */
+void ipi_send(uint32_t cpu);
+/*! Returns true (and acknowledges it) if the calling core has been interrupted by another */
+bool ipi_irq(void);
+#endif
+
 uint32_t busy_wait_millis(uint32_t millis);
 
 #endif // __BCM2835_H__
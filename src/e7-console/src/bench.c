@@ -0,0 +1,422 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* bench.c
+ *
+ * Kernel microbenchmarks. Build with APP=bench to run these in place of
+ * app_main. Results are written to the console, in cycles, one line per
+ * benchmark:
+ *
+ *   BENCH-BEGIN cpu_hz=<hz> samples=<n> batch=<ops>
+ *   BENCH name=<name> n=<samples> min=<cycles> avg=<cycles> max=<cycles>
+ *   BENCH name=<name> error=<reason>
+ *   BENCH-END
+ *
+ * Throughput benchmarks time batches of operations, so each sample is the
+ * average over a batch; latency benchmarks time individual operations.
+ */
+#include "toast.h"
+#include "str.h"
+#include "kprintf.h"
+#include "svc.h"
+
+#define SAMPLES 32  // samples per benchmark
+#define BATCH   64  // operations per sample, for throughput benchmarks
+
+typedef struct Stats_S {
+    uint32_t n;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} Stats;
+
+static void stats_init(Stats * s) {
+    s->n = 0;
+    s->min = (uint32_t)(-1);
+    s->max = 0;
+    s->sum = 0;
+}
+
+static void stats_add(Stats * s, uint32_t val) {
+    s->n++;
+    s->sum += val;
+    if(val<s->min) {
+        s->min = val;
+    }
+    if(val>s->max) {
+        s->max = val;
+    }
+}
+
+static char * append(char * p, const char * str) {
+    while(*str) {
+        *p++ = *str++;
+    }
+    return p;
+}
+
+static void con_puts(const char * str) {
+    sys_write(str,str_len(str));
+}
+
+static void report(const char * name, Stats * s) {
+    char line[128];
+    sys_write(line,ksnprintf(line,sizeof(line),"BENCH name=%s n=%u min=%u avg=%u max=%u\r\n",
+                             name,s->n,s->min,s->n ? (uint32_t)(s->sum/s->n) : 0,s->max));
+}
+
+typedef void (*BenchFn)(uint32_t ops);
+
+// Set by a benchmark that couldn't do all of its operations; its samples would be wrong
+static const char * bench_error;
+
+/*! Time batches of operations; each sample is the cost of one operation above base, divided by per */
+static void bench_samples(BenchFn fn, uint32_t base, uint32_t per, Stats * s) {
+    stats_init(s);
+    bench_error = NULL;
+    fn(BATCH); // warm-up
+    for(int i=0; i<SAMPLES && !bench_error; i++) {
+        uint32_t start = sys_cycles();
+        fn(BATCH);
+        uint32_t cycles = (sys_cycles()-start)/BATCH;
+        stats_add(s,cycles>base ? (cycles-base)/per : 0);
+    }
+}
+
+/*! Time batches of operations; each sample is the average cost of one operation */
+static void bench_ops(const char * name, BenchFn fn) {
+    Stats s;
+    bench_samples(fn,0,1,&s);
+    if(bench_error) {
+        char line[128];
+        sys_write(line,ksnprintf(line,sizeof(line),"BENCH name=%s error=%s\r\n",name,bench_error));
+        return;
+    }
+    report(name,&s);
+}
+
+static volatile bool stop;
+static uint32_t mid;
+
+static void null_swi(uint32_t ops) {
+    while(ops--) {
+        sys_get_pid();
+    }
+}
+
+// The same SWI, issued inline rather than through the sys_get_pid stub
+static void null_svc_inline(uint32_t ops) {
+    while(ops--) {
+        svc_get_pid(0,0,0);
+    }
+}
+
+// The same SWI, through the stub from before syscalls.def (run with sys_entry_baseline)
+static void null_swi_baseline(uint32_t ops) {
+    while(ops--) {
+        sys_get_pid_baseline();
+    }
+}
+
+static void clock_millis(uint32_t ops) {
+    while(ops--) {
+        sys_clock_millis();
+    }
+}
+
+static void now_us(uint32_t ops) {
+    while(ops--) {
+        toast_now_us();
+    }
+}
+
+static void yield(uint32_t ops) {
+    while(ops--) {
+        sys_yield();
+    }
+}
+
+// Each round trip is two context switches
+static void yield_pair(uint32_t ops) {
+    for(ops/=2; ops>0; ops--) {
+        sys_yield();
+    }
+}
+
+static uint32_t yielder(uint32_t init_param) {
+    while(!stop) {
+        sys_yield();
+    }
+    return 0;
+}
+
+static void mon_enter_exit(uint32_t ops) {
+    while(ops--) {
+        sys_mon_enter(mid);
+        sys_mon_exit(mid);
+    }
+}
+
+// Hold the monitor across a yield, so that the other process has to queue
+static void mon_enter_yield_exit(uint32_t ops) {
+    while(ops--) {
+        sys_mon_enter(mid);
+        sys_yield();
+        sys_mon_exit(mid);
+    }
+}
+
+static uint32_t mon_contender(uint32_t init_param) {
+    while(!stop) {
+        mon_enter_yield_exit(1);
+    }
+    return 0;
+}
+
+static volatile uint32_t notify_cycles;
+
+static uint32_t mon_notifier(uint32_t init_param) {
+    while(!stop) {
+        sys_mon_enter(mid);
+        notify_cycles = sys_cycles();
+        sys_mon_notify(mid);
+        sys_mon_exit(mid);
+        sys_yield();
+    }
+    return 0;
+}
+
+// Update four LEDs, one trap per LED
+static void set_led_x4(uint32_t ops) {
+    while(ops--) {
+        sys_set_led(SYS_LED_RED,ops&1);
+        sys_set_led(SYS_LED_YELLOW,ops&1);
+        sys_set_led(SYS_LED_GREEN,ops&1);
+        sys_set_led(SYS_LED_BLUE,ops&1);
+    }
+}
+
+// Update four LEDs with a single trap
+static void gpio_write_mask_x4(uint32_t ops) {
+    const uint32_t leds = GPIO_BIT(SYS_LED_RED) | GPIO_BIT(SYS_LED_YELLOW)
+                        | GPIO_BIT(SYS_LED_GREEN) | GPIO_BIT(SYS_LED_BLUE);
+    while(ops--) {
+        sys_gpio_write_mask(GPIO_BANK(SYS_LED_RED),(ops&1) ? leds : 0,(ops&1) ? 0 : leds);
+    }
+}
+
+// Update four LEDs with one trap, through the submission/completion rings
+static void ring_set_led_x4(uint32_t ops) {
+    static Ring ring;
+    static const uint32_t leds[4] = { SYS_LED_RED, SYS_LED_YELLOW, SYS_LED_GREEN, SYS_LED_BLUE };
+    RingComplete c;
+    sys_ring_setup(&ring,0);
+    while(ops--) {
+        for(int i=0; i<4; i++) {
+            ring_submit(&ring,RING_OP_SET_LED,leds[i],ops&1,0,i);
+        }
+        sys_ring_enter();
+        while(ring_complete(&ring,&c)) {
+        }
+    }
+    sys_ring_setup(NULL,0);
+}
+
+static uint32_t nop_proc(uint32_t init_param) {
+    return 0;
+}
+
+static void fork_exit(uint32_t ops) {
+    while(ops--) {
+        sys_wait(sys_fork(nop_proc,0,0),NULL);
+    }
+}
+
+typedef uint32_t (*FormatFn)(char * line, uint32_t val);
+
+// Format a status line by chaining itoa calls (a division and modulo per digit)
+static uint32_t format_itoa(char * line, uint32_t val) {
+    char buff[12];
+    char * p = line;
+    p = append(p,"pid=");
+    p = append(p,itoa(val&7,buff,10));
+    p = append(p," ticks=");
+    p = append(p,itoa(val*7919,buff,10));
+    p = append(p," pc=0x");
+    p = append(p,itoa((val*40503)&0x7FFFFFFF,buff,16));
+    p = append(p,"\r\n");
+    return p-line;
+}
+
+// The same line with ksnprintf (reciprocal multiplication)
+static uint32_t format_ksnprintf(char * line, uint32_t val) {
+    return ksnprintf(line,64,"pid=%u ticks=%u pc=0x%X\r\n",val&7,val*7919,(val*40503)&0x7FFFFFFF);
+}
+
+/*! Time batches of formatted lines; each sample is the cost per character */
+static void bench_format(const char * name, FormatFn fn) {
+    Stats s;
+    stats_init(&s);
+    char line[64];
+    for(int i=0; i<SAMPLES; i++) {
+        uint32_t chars = 0;
+        uint32_t start = sys_cycles();
+        for(uint32_t op=0; op<BATCH; op++) {
+            chars += fn(line,i*BATCH+op);
+        }
+        stats_add(&s,(sys_cycles()-start)/chars);
+    }
+    report(name,&s);
+}
+
+#define SPAWN_WORKERS 4 // Process slots left over for workers
+
+// Create (and reap) the workers in batches, one trap per batch
+static void spawn_batch_exit(uint32_t ops) {
+    while(ops) {
+        uint32_t n = sys_spawn_batch(nop_proc,ops<SPAWN_WORKERS ? ops : SPAWN_WORKERS,0);
+        if(!n) {
+            bench_error = "out_of_process_slots";
+            return;
+        }
+        for(uint32_t i=0; i<n; i++) {
+            sys_wait(PID_ANY,NULL);
+        }
+        ops -= n;
+    }
+}
+
+/*! Run a benchmark with a second process at the same priority */
+static void bench_with(const char * name, BenchFn fn, ProcessMainFn partner) {
+    stop = false;
+    uint32_t pid = sys_fork(partner,0,0);
+    bench_ops(name,fn);
+    stop = true;
+    sys_wait(pid,NULL);
+}
+
+#define EVT_PING  0b001
+#define EVT_PONG  0b010
+#define EVT_PARK  0b100  // Never set while the parked processes are needed
+
+#define PARKED_PROCS (SPAWN_WORKERS-1) // Waiters parked on the queue; the ponger takes the last slot
+
+static uint32_t q_eid;
+
+// A round trip through the event flags' wait queue: each side waits, and is woken by the other's set
+static void evt_ping(uint32_t ops) {
+    while(ops--) {
+        sys_evt_set(q_eid,EVT_PING);
+        sys_evt_wait(q_eid,EVT_PONG,EVT_WAIT_ANY|EVT_CONSUME);
+    }
+}
+
+static uint32_t evt_ponger(uint32_t init_param) {
+    while(1) {
+        sys_evt_wait(q_eid,EVT_PING,EVT_WAIT_ANY|EVT_CONSUME);
+        if(stop) {
+            return 0;
+        }
+        sys_evt_set(q_eid,EVT_PONG);
+    }
+}
+
+static uint32_t evt_parker(uint32_t init_param) {
+    sys_evt_wait(q_eid,EVT_PARK,EVT_WAIT_ANY);
+    return 0;
+}
+
+/*! Cost of each blocked process on a wait queue, per round trip.
+ *
+ * Times an event flag ping-pong on an empty queue, and again with
+ * PARKED_PROCS waiters (at the same priority, on a flag that is never set)
+ * queued ahead of both sides. Each wait walks past every parked process to
+ * insert behind it, and each set checks every one for a match, so the
+ * difference divided by PARKED_PROCS is the cost of four queue steps (see the
+ * Process layout in proctl.h.)
+ */
+static void bench_wait_q(void) {
+    Stats s;
+    q_eid = sys_evt_create();
+    stop = false;
+    uint32_t ponger = sys_fork(evt_ponger,0,0);
+    bench_samples(evt_ping,0,1,&s);
+    report("evt_ping_pong",&s);
+    uint32_t base = (uint32_t)(s.sum/s.n);
+
+    uint32_t parked = sys_spawn_batch(evt_parker,PARKED_PROCS,0);
+    sys_sleep_millis(1); // let them block
+    if(parked!=PARKED_PROCS) {
+        con_puts("BENCH name=evt_q_per_waiter error=out_of_process_slots\r\n");
+    } else {
+        bench_samples(evt_ping,base,PARKED_PROCS,&s);
+        report("evt_q_per_waiter",&s);
+    }
+    stop = true;
+    sys_evt_set(q_eid,EVT_PING|EVT_PARK);
+    sys_wait(ponger,NULL);
+    for(uint32_t i=0; i<parked; i++) {
+        sys_wait(PID_ANY,NULL);
+    }
+}
+
+/*! Time from monitor notify (in a lower-priority process) until the waiting process runs */
+static void bench_notify_latency(void) {
+    Stats s;
+    stats_init(&s);
+    stop = false;
+    uint32_t pid = sys_fork(mon_notifier,0,1);
+    sys_mon_enter(mid);
+    for(int i=0; i<SAMPLES; i++) {
+        sys_mon_wait(mid);
+        stats_add(&s,sys_cycles()-notify_cycles);
+    }
+    stop = true;
+    sys_mon_exit(mid);
+    sys_wait(pid,NULL);
+    report("mon_notify_wakeup",&s);
+}
+
+/*! Lateness of wake-up from a 1ms sleep */
+static void bench_sleep_jitter(void) {
+    Stats s;
+    stats_init(&s);
+    const uint32_t expected = CPU_CLOCK_HZ/1000;
+    for(int i=0; i<SAMPLES; i++) {
+        uint32_t start = sys_cycles();
+        sys_sleep_millis(1);
+        uint32_t elapsed = sys_cycles()-start;
+        stats_add(&s,elapsed>expected ? elapsed-expected : 0);
+    }
+    report("sleep_1ms_late",&s);
+}
+
+uint32_t bench_main(uint32_t init_param) {
+    char line[96];
+    mid = sys_mon_create();
+    sys_write(line,ksnprintf(line,sizeof(line),"\r\nBENCH-BEGIN cpu_hz=%u samples=%u batch=%u\r\n",
+                             CPU_CLOCK_HZ,SAMPLES,BATCH));
+
+    bench_ops("null_swi",null_swi);
+    bench_ops("null_svc_inline",null_svc_inline);
+    sys_entry_baseline(true); // the old entry path and router, for comparison
+    bench_ops("null_swi_baseline",null_swi_baseline);
+    sys_entry_baseline(false);
+    bench_ops("clock_millis_swi",clock_millis);
+    bench_ops("now_us",now_us);
+    bench_ops("yield",yield);
+    bench_ops("set_led_x4",set_led_x4);
+    bench_ops("gpio_write_mask_x4",gpio_write_mask_x4);
+    bench_ops("ring_set_led_x4",ring_set_led_x4);
+    bench_with("context_switch",yield_pair,yielder);
+    bench_wait_q();
+    bench_ops("mon_enter_exit",mon_enter_exit);
+    bench_with("mon_enter_exit_contended",mon_enter_yield_exit,mon_contender);
+    bench_notify_latency();
+    bench_ops("fork_exit",fork_exit);
+    bench_ops("spawn_batch_exit",spawn_batch_exit);
+    bench_sleep_jitter();
+    bench_format("format_itoa_per_char",format_itoa);
+    bench_format("format_ksnprintf_per_char",format_ksnprintf);
+
+    con_puts("BENCH-END\r\n");
+    return 0;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* boot.c
+ *
+ * Boot-phase timestamps. Only called in Supervisor-mode, before the first dispatch.
+ */
+#include <stdint.h>
+#include "boot.h"
+#include "bcm2835.h"
+#include "klog.h"
+#include "toast.h"
+
+// The reset and vectors phases are marked before .bss is cleared
+static uint32_t __attribute__((section(".data"))) boot_us[BOOT_PHASES];
+
+static const char * boot_phase_names[BOOT_PHASES] = {
+    "reset", "vectors", "p_init", "dispatch"
+};
+
+void boot_mark(uint32_t phase) {
+    if(phase<BOOT_PHASES) {
+        boot_us[phase] = (uint32_t)system_timer();
+    }
+}
+
+uint32_t boot_time(uint32_t phase) {
+    return phase<BOOT_PHASES ? boot_us[phase] : 0;
+}
+
+void boot_report(void) {
+    if(!KLOG_ENABLED(KLOG_INFO)) {
+        return;
+    }
+    // The system timer starts at power-on, so the reset time is what the firmware took
+    for(uint32_t phase=0; phase<BOOT_PHASES; phase++) {
+        KLogRecord * r = klog_begin(KLOG_INFO,PID_NONE);
+        klog_str(r,"boot: ");
+        klog_str(r,boot_phase_names[phase]);
+        if(phase==BOOT_RESET) {
+            klog_str(r," at ");
+            klog_num(r,boot_us[phase],10);
+        } else {
+            klog_str(r," +");
+            klog_num(r,boot_us[phase]-boot_us[phase-1],10);
+        }
+        klog_str(r," us");
+        klog_commit(r);
+    }
+    KLogRecord * r = klog_begin(KLOG_INFO,PID_NONE);
+    klog_str(r,"boot: reset to dispatch ");
+    klog_num(r,boot_us[BOOT_DISPATCH]-boot_us[BOOT_RESET],10);
+    klog_str(r," us");
+    klog_commit(r);
+}
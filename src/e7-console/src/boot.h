@@ -0,0 +1,29 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __BOOT_H__
+#define __BOOT_H__
+/* boot.h
+ *
+ * Boot-phase timestamps. reset_handler and s_init mark the end of each
+ * phase with the system timer (microseconds since power-on), and s_init
+ * logs the phase durations before the first dispatch.
+ */
+
+// Boot phases (also used by start.S)
+#define BOOT_RESET    0 // Entry to reset_handler
+#define BOOT_VECTORS  1 // Exception vector copied
+#define BOOT_P_INIT   2 // Process control initialized
+#define BOOT_DISPATCH 3 // First process about to be dispatched
+#define BOOT_PHASES   4
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+/*! Record the system timer at the given boot phase */
+void boot_mark(uint32_t phase);
+/*! System timer (microseconds) at the given boot phase, or 0 if it hasn't been reached */
+uint32_t boot_time(uint32_t phase);
+/*! Log the boot phase timestamps */
+void boot_report(void);
+#endif
+
+#endif // __BOOT_H__
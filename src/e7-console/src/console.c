@@ -0,0 +1,416 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* console.c
+ *
+ * Console command interpreter. Runs as a user process.
+ *
+ */
+#include "toast.h"
+#include "str.h"
+#include "kprintf.h"
+#include "swi-ops.h"
+
+#define LINE_MAX  64
+#define MAX_PIDS  32    // Max pid tracked by top
+#define TOP_MILLIS 1000 // top refresh interval
+
+static void con_puts(const char * str) {
+    sys_write(str,str_len(str));
+}
+
+/*! Write a string, padded to the given width */
+static void con_put_field(const char * str, uint32_t width) {
+    uint32_t len = str_len(str);
+    con_puts(str);
+    while(len++<width) {
+        sys_write(" ",1);
+    }
+}
+
+static void con_put_num(uint32_t val, uint32_t width) {
+    char buff[12];
+    ksnprintf(buff,sizeof(buff),"%u",val);
+    con_put_field(buff,width);
+}
+
+static const char * state_names[] = {
+    "RUN", "READY", "SLEEP", "MON", "COND", "SEM", "EVT", "WAIT", "READ", "WRITE", "ZOMBIE", "GPIO", "ANY"
+};
+
+/*! Read a line from the console, with echo and basic line editing */
+static uint32_t read_line(char * line, uint32_t len) {
+    uint32_t n = 0;
+    while(1) {
+        char c;
+        sys_read(&c,1);
+        if(c=='\r' || c=='\n') {
+            con_puts("\r\n");
+            line[n] = 0;
+            return n;
+        }
+        if(c=='\b' || c==0x7F) {
+            if(n>0) {
+                n--;
+                con_puts("\b \b");
+            }
+        } else if(c>=' ' && n<len-1) {
+            line[n++] = c;
+            sys_write(&c,1);
+        }
+    }
+}
+
+/*! Returns true if the line starts with the given command word */
+static bool is_cmd(const char * line, const char * cmd, const char ** args) {
+    while(*cmd) {
+        if(*line++!=*cmd++) {
+            return false;
+        }
+    }
+    if(*line!=0 && *line!=' ') {
+        return false;
+    }
+    while(*line==' ') {
+        line++;
+    }
+    *args = line;
+    return true;
+}
+
+/*! Write the process table.
+ *
+ * CPU share is computed from the ticks charged to each process since the
+ * given baseline (indexed by pid), which is then updated.
+ */
+static void show_procs(uint32_t * baseline, const char * eol) {
+    ProcInfo info[MAX_PIDS];
+    uint32_t n = 0;
+    uint32_t total = 0;
+    for(uint32_t pid=0; n<MAX_PIDS && (pid=sys_proc_info(pid,&info[n]))!=PID_NONE; pid++) {
+        uint32_t ticks = info[n].ticks;
+        if(pid<MAX_PIDS && ticks>=baseline[pid]) {
+            ticks -= baseline[pid];
+        }
+        total += ticks;
+        n++;
+    }
+    con_puts("\033[7m");
+    con_puts("PID PPID PRI STATE  ON   CPU% SWITCHES");
+    con_puts("\033[0m");
+    con_puts(eol);
+    for(uint32_t i=0; i<n; i++) {
+        ProcInfo * p = &info[i];
+        uint32_t ticks = p->ticks;
+        if(p->pid<MAX_PIDS) {
+            if(ticks>=baseline[p->pid]) {
+                ticks -= baseline[p->pid];
+            }
+            baseline[p->pid] = p->ticks;
+        }
+        con_put_num(p->pid,4);
+        if(p->parent_pid==PID_NONE) {
+            con_put_field("-",5);
+        } else {
+            con_put_num(p->parent_pid,5);
+        }
+        con_put_num(p->priority,4);
+        con_put_field(p->state<=PS_ANY ? state_names[p->state] : "?",7);
+        switch(p->state) {
+        case PS_MON_ENTER:
+        case PS_MON_WAIT:
+            con_puts("m");
+            con_put_num(p->wait_id,4);
+            break;
+        case PS_SEM:
+            con_puts("s");
+            con_put_num(p->wait_id,4);
+            break;
+        case PS_EVT:
+            con_puts("e");
+            con_put_num(p->wait_id,4);
+            break;
+        case PS_CHILD:
+            if(p->wait_id==PID_ANY) {
+                con_put_field("p*",5);
+            } else {
+                con_puts("p");
+                con_put_num(p->wait_id,4);
+            }
+            break;
+        case PS_ANY:
+            con_puts("#"); // number of event sources
+            con_put_num(p->wait_id,4);
+            break;
+        default:
+            con_put_field("-",5);
+        }
+        con_put_num(total ? ticks*100/total : 0,5);
+        con_put_num(p->switches,0);
+        con_puts(eol);
+    }
+}
+
+static uint32_t countdown_proc(uint32_t init_param) {
+    int n = init_param;
+    sys_log("countdown_proc starting");
+    while(n>0) {
+        sys_log(".");
+        sys_sleep_millis(100);
+        n--;
+    }
+    sys_log("countdown_proc exiting");
+    return 0;
+}
+
+/*
+ * Profile dump format (see tools/prof2sym.py):
+ *   PROF-BEGIN
+ *   PROF <pid> <pc, hex> <samples>
+ *   PROF-END
+ */
+static void cmd_prof(const char * args) {
+    const char * period;
+    if(is_cmd(args,"start",&period)) {
+        uint32_t n = 0;
+        while(*period>='0' && *period<='9') {
+            n = n*10 + (*period++ - '0');
+        }
+        sys_prof_ctl(n ? n : 1);
+    } else if(is_cmd(args,"stop",&period)) {
+        sys_prof_ctl(0);
+    } else if(is_cmd(args,"dump",&period)) {
+        ProfSample sample;
+        char line[40];
+        con_puts("PROF-BEGIN\r\n");
+        for(uint32_t i=0; (i=sys_prof_read(i,&sample))!=PROF_NONE; i++) {
+            sys_write(line,ksnprintf(line,sizeof(line),"PROF %u %X %u\r\n",sample.pid,sample.pc,sample.count));
+        }
+        con_puts("PROF-END\r\n");
+    } else {
+        con_puts("usage: prof start [N] | stop | dump\r\n");
+    }
+}
+
+static const struct {
+    uint32_t swi;
+    const char * name;
+} swi_names[] = {
+#define SYSCALL(num,NAME,name,stub) { SWI_##NAME, #name },
+#include "syscalls.def"
+#undef SYSCALL
+};
+
+/*! Write the latency statistics of each system call, in cycles */
+static void cmd_swistat(const char * args) {
+    const char * rest;
+    if(is_cmd(args,"reset",&rest)) {
+        sys_swi_stat(0,NULL);
+        return;
+    }
+    SwiStat stat;
+    char line[80];
+    con_put_field("SWI",6);
+    con_put_field("NAME",17);
+    con_put_field("CALLS",10);
+    con_put_field("P50",10);
+    con_put_field("P99",10);
+    con_puts("MAX\r\n");
+    for(uint32_t swi=0; (swi=sys_swi_stat(swi,&stat))!=SWI_NONE; swi++) {
+        const char * name = "?";
+        for(uint32_t i=0; i<sizeof(swi_names)/sizeof(swi_names[0]); i++) {
+            if(swi_names[i].swi==stat.swi) {
+                name = swi_names[i].name;
+            }
+        }
+        sys_write(line,ksnprintf(line,sizeof(line),"%-6X%-17s%-10u%-10u%-10u%u\r\n",
+                                 stat.swi,name,stat.count,stat.p50,stat.p99,stat.max));
+    }
+}
+
+static void cmd_help(void) {
+    con_puts("help         this help\r\n");
+    con_puts("ps           list processes\r\n");
+    con_puts("top          live process list; press any key to quit\r\n");
+    con_puts("countdown N  fork a process that counts down from N (1-9)\r\n");
+    con_puts("prof start [N] | stop | dump\r\n");
+    con_puts("             sample the running process every N timer ticks; dump the samples\r\n");
+    con_puts("swistat [reset]\r\n");
+    con_puts("             system-call latency (p50, p99, max) in cycles; clear the statistics\r\n");
+    con_puts("perf COMMAND run a command in a child process; report its cycles and PMU events\r\n");
+    con_puts("perf events EVENT EVENT\r\n");
+    con_puts("             select the PMU events to count (perf events ? for a list)\r\n");
+}
+
+static void cmd_ps(void) {
+    // Share of all ticks since start-up
+    uint32_t baseline[MAX_PIDS] = {0};
+    show_procs(baseline,"\r\n");
+}
+
+/*! Refresh the process table in place, until a key is pressed */
+static void cmd_top(void) {
+    uint32_t baseline[MAX_PIDS] = {0};
+    const WaitSource key_or_refresh[] = {
+        { WAIT_SRC_READ, 0, 0 },
+        { WAIT_SRC_TIMEOUT, TOP_MILLIS, 0 },
+    };
+    con_puts("\033[2J"); // clear screen
+    do {
+        con_puts("\033[H"); // cursor home
+        con_puts("top - press any key to quit\033[K\r\n\033[K\r\n");
+        show_procs(baseline,"\033[K\r\n");
+        con_puts("\033[J"); // clear to end of screen
+    } while(sys_wait_any(key_or_refresh,2)!=0);
+    char c;
+    sys_read(&c,1);
+    con_puts("\r\n");
+}
+
+static void cmd_countdown(const char * args) {
+    if(args[0]<'1' || args[0]>'9') {
+        con_puts("usage: countdown N\r\n");
+        return;
+    }
+    if(sys_fork(countdown_proc,(uint32_t)(args[0]-'0'),0)==PID_NONE) {
+        con_puts("out of process slots\r\n");
+    }
+}
+
+static void run_cmd(const char * line);
+
+static const struct {
+    uint32_t evt;
+    const char * name;
+} perf_events[] = {
+    { PERF_EVT_ICACHE_MISS, "icache-miss" },
+    { PERF_EVT_IBUF_STALL, "ibuf-stall" },
+    { PERF_EVT_DATA_STALL, "data-stall" },
+    { PERF_EVT_IMTLB_MISS, "imtlb-miss" },
+    { PERF_EVT_DMTLB_MISS, "dmtlb-miss" },
+    { PERF_EVT_BRANCH, "branch" },
+    { PERF_EVT_BRANCH_MISS, "branch-miss" },
+    { PERF_EVT_INSTR, "instr" },
+    { PERF_EVT_DCACHE_ACCESS, "dcache-access" },
+    { PERF_EVT_DCACHE_MISS, "dcache-miss" },
+    { PERF_EVT_DCACHE_WB, "dcache-wb" },
+    { PERF_EVT_TLB_MISS, "tlb-miss" },
+};
+#define PERF_EVENT_NAMES (sizeof(perf_events)/sizeof(perf_events[0]))
+
+/*! Returns the index of the event name at the start of str (and skips past it), or PERF_EVENT_NAMES */
+static uint32_t perf_event_parse(const char ** str) {
+    for(uint32_t i=0; i<PERF_EVENT_NAMES; i++) {
+        const char * rest;
+        if(is_cmd(*str,perf_events[i].name,&rest)) {
+            *str = rest;
+            return i;
+        }
+    }
+    return PERF_EVENT_NAMES;
+}
+
+static const char * perf_event_name(uint32_t evt) {
+    for(uint32_t i=0; i<PERF_EVENT_NAMES; i++) {
+        if(perf_events[i].evt==evt) {
+            return perf_events[i].name;
+        }
+    }
+    return "?";
+}
+
+/*! Write a count, right-aligned, followed by its name */
+static void perf_put_count(uint64_t count, const char * name) {
+    char buff[24];
+    ksnprintf(buff,sizeof(buff),"%19llu",count); // no 64-bit divide (see kprintf.h)
+    con_puts(buff);
+    con_puts("  ");
+    con_puts(name);
+    con_puts("\r\n");
+}
+
+static uint32_t perf_proc(uint32_t line) {
+    run_cmd((const char *)line);
+    return 0;
+}
+
+/*! Run a command in a child process, and report the PMU counts of the child (and its descendants) */
+static void cmd_perf(const char * args) {
+    const char * rest;
+    if(is_cmd(args,"events",&rest)) {
+        uint32_t e0 = perf_event_parse(&rest);
+        uint32_t e1 = perf_event_parse(&rest);
+        if(e0==PERF_EVENT_NAMES || e1==PERF_EVENT_NAMES) {
+            con_puts("events:");
+            for(uint32_t i=0; i<PERF_EVENT_NAMES; i++) {
+                con_puts(" ");
+                con_puts(perf_events[i].name);
+            }
+            con_puts("\r\n");
+            return;
+        }
+        sys_perf_ctl(perf_events[e0].evt,perf_events[e1].evt);
+        return;
+    }
+    if(*args==0) {
+        con_puts("usage: perf COMMAND | perf events EVENT EVENT\r\n");
+        return;
+    }
+    uint32_t self = sys_get_pid();
+    PerfStat before;
+    PerfStat after;
+    sys_perf_read(self,PERF_CHILDREN,&before);
+    uint32_t pid = sys_fork(perf_proc,(uint32_t)args,0);
+    if(pid==PID_NONE) {
+        con_puts("out of process slots\r\n");
+        return;
+    }
+    sys_wait(pid,NULL);
+    sys_perf_read(self,PERF_CHILDREN,&after);
+    con_puts("perf stats for '");
+    con_puts(args);
+    con_puts("':\r\n");
+    perf_put_count(after.cycles-before.cycles,"cycles");
+    for(int i=0; i<2; i++) {
+        perf_put_count(after.events[i]-before.events[i],perf_event_name(after.types[i]));
+    }
+}
+
+static void run_cmd(const char * line) {
+    const char * args;
+    if(is_cmd(line,"help",&args)) {
+        cmd_help();
+    } else if(is_cmd(line,"ps",&args)) {
+        cmd_ps();
+    } else if(is_cmd(line,"top",&args)) {
+        cmd_top();
+    } else if(is_cmd(line,"countdown",&args)) {
+        cmd_countdown(args);
+    } else if(is_cmd(line,"prof",&args)) {
+        cmd_prof(args);
+    } else if(is_cmd(line,"swistat",&args)) {
+        cmd_swistat(args);
+    } else if(is_cmd(line,"perf",&args)) {
+        cmd_perf(args);
+    } else {
+        con_puts("unknown command: ");
+        con_puts(line);
+        con_puts("\r\n");
+    }
+}
+
+void console_main(void) {
+    char line[LINE_MAX];
+    con_puts("type 'help' for a list of commands\r\n");
+    while(1) {
+        // Reap any children that have terminated
+        uint32_t reaped;
+        do {
+            reaped = sys_try_wait(PID_ANY,NULL);
+        } while(reaped!=W_NO_CHILD && reaped!=W_RUNNING);
+
+        con_puts("\033[32;1mtoast>\033[0m ");
+        if(read_line(line,sizeof(line))==0) {
+            continue;
+        }
+        run_cmd(line);
+    }
+}
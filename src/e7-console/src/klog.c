@@ -0,0 +1,117 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* klog.c
+ *
+ * Kernel log ring.
+ *
+ * Single producer (the kernel, with interrupts disabled) and single consumer
+ * (the log process), so the ring needs no locking: the producer only
+ * advances head, and the consumer only advances tail. On SMP builds they may
+ * run on different cores, so a barrier orders each record with the head or
+ * tail that hands it over.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "klog.h"
+#include "arm.h"
+#include "proctl.h"
+#include "bcm2835.h"
+#include "kprintf.h"
+
+static struct {
+    volatile uint32_t head;      // next record to write
+    volatile uint32_t tail;      // next record to read
+    uint32_t overflow;           // number of dropped records
+    uint32_t eid;                // event flag group used to signal the log process
+    KLogRecord records[KLOG_RECORDS];
+} klog_ring = { .eid = EID_NONE };
+
+uint32_t klog_init() {
+    klog_ring.eid = evt_create();
+    return klog_ring.eid;
+}
+
+KLogRecord * klog_record_begin(uint32_t level, uint32_t pid) {
+    if(klog_ring.head-klog_ring.tail==KLOG_RECORDS) {
+        klog_ring.overflow++;
+        return NULL;
+    }
+    MEMORY_BARRIER(); // The log process is done with the record before we overwrite it
+    KLogRecord * r = &klog_ring.records[klog_ring.head & (KLOG_RECORDS-1)];
+    r->timestamp = system_timer();
+    r->pid = pid;
+    r->level = level;
+    r->len = 0;
+    return r;
+}
+
+void klog_record_str(KLogRecord * r, const char * str) {
+    while(*str && r->len<KLOG_TEXT_SIZE) {
+        r->text[r->len++] = *str++;
+    }
+}
+
+void klog_record_num(KLogRecord * r, int val, int base) {
+    char buff[12];
+    ksnprintf(buff,sizeof(buff),base==16 ? "%X" : "%d",val);
+    klog_record_str(r,buff);
+}
+
+void klog_record_commit(KLogRecord * r) {
+    MEMORY_BARRIER(); // Write the record before the head that publishes it
+    klog_ring.head++;
+    if(klog_ring.eid!=EID_NONE) {
+        evt_set(klog_ring.eid,KLOG_EVT_PENDING);
+    }
+}
+
+const KLogRecord * klog_first() {
+    if(klog_ring.head==klog_ring.tail) {
+        return NULL;
+    }
+    MEMORY_BARRIER(); // Read the record after the head that published it
+    return &klog_ring.records[klog_ring.tail & (KLOG_RECORDS-1)];
+}
+
+void klog_release() {
+    MEMORY_BARRIER(); // Done reading the record before the slot is handed back
+    klog_ring.tail++;
+}
+
+uint32_t klog_overflow() {
+    return klog_ring.overflow;
+}
+
+static uint32_t append(char * buff, uint32_t n, uint32_t size, const char * str, uint32_t len) {
+    while(len-- && n<size-1) {
+        buff[n++] = *str++;
+    }
+    buff[n] = 0;
+    return n;
+}
+
+uint32_t klog_format(const KLogRecord * r, char * buff, uint32_t size) {
+    static const char * level_color[] = { "\033[31;1m", "\033[35;1m", "\033[33;1m", "\033[36m" };
+    const char * color = level_color[r->level & 3];
+    uint32_t millis = (uint32_t)udiv1000_u64(r->timestamp);
+    uint32_t n;
+    if(r->pid==PID_NONE) {
+        n = ksnprintf(buff,size,"%s[%u] kernel: \033[0m",color,millis);
+    } else {
+        n = ksnprintf(buff,size,"%s[%u] pid=%u: \033[0m",color,millis,r->pid);
+    }
+    if(n>=size) {
+        n = size-1;
+    }
+    n = append(buff,n,size,r->text,r->len);
+    n = append(buff,n,size,"\r\n",2);
+    return n;
+}
+
+void klog_flush() {
+    char buff[96];
+    for(const KLogRecord * r; (r = klog_first()); klog_release()) {
+        klog_format(r,buff,sizeof(buff));
+        uart_puts(buff);
+    }
+    uart_flush();
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __KLOG_H__
+#define __KLOG_H__
+/* klog.h
+ *
+ * Kernel log ring. Log records are written by the kernel (with interrupts
+ * disabled) and drained by a low-priority log process, so logging never
+ * waits for the UART. When the ring is full, records are dropped and counted.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+// Log levels
+#define KLOG_ERROR 0
+#define KLOG_WARN  1
+#define KLOG_INFO  2
+#define KLOG_DEBUG 3
+
+// Records above this level are compiled out
+#ifndef KLOG_LEVEL
+#define KLOG_LEVEL KLOG_INFO
+#endif
+
+#define KLOG_ENABLED(level) ((level)<=KLOG_LEVEL)
+
+#define KLOG_TEXT_SIZE 48
+#define KLOG_RECORDS   32 // must be a power of 2
+
+typedef struct KLogRecord_S {
+    uint64_t timestamp;          // System timer (microseconds)
+    uint32_t pid;                // Process the record is about (or PID_NONE)
+    uint16_t level;              // Log level
+    uint16_t len;                // Length of text
+    char text[KLOG_TEXT_SIZE];   // Message text (not NUL terminated)
+} KLogRecord;
+
+/*! Initialize the log ring. Returns the event flag group used to signal the log process */
+uint32_t klog_init();
+
+KLogRecord * klog_record_begin(uint32_t level, uint32_t pid);
+void klog_record_str(KLogRecord * r, const char * str);
+void klog_record_num(KLogRecord * r, int val, int base);
+void klog_record_commit(KLogRecord * r);
+
+// The wrappers below short-circuit records above KLOG_LEVEL at compile time,
+// so a disabled record costs nothing (not even its arguments' calls)
+
+/*! Start a new record. Returns NULL (and counts an overflow) if the ring is full, or if the level is disabled */
+static inline KLogRecord * klog_begin(uint32_t level, uint32_t pid) {
+    return KLOG_ENABLED(level) ? klog_record_begin(level,pid) : (KLogRecord *)0;
+}
+/*! Append a string to a record */
+static inline void klog_str(KLogRecord * r, const char * str) {
+    if(r) {
+        klog_record_str(r,str);
+    }
+}
+/*! Append a number to a record */
+static inline void klog_num(KLogRecord * r, int val, int base) {
+    if(r) {
+        klog_record_num(r,val,base);
+    }
+}
+/*! Publish a record to the log process */
+static inline void klog_commit(KLogRecord * r) {
+    if(r) {
+        klog_record_commit(r);
+    }
+}
+
+/*! Log a message */
+static inline void klog(uint32_t level, uint32_t pid, const char * msg) {
+    KLogRecord * r = klog_begin(level,pid);
+    klog_str(r,msg);
+    klog_commit(r);
+}
+
+// Log process interface
+#define KLOG_EVT_PENDING 0b00000001 // Records are pending
+
+/*! The oldest pending record, or NULL if there are none */
+const KLogRecord * klog_first();
+/*! Release the oldest pending record */
+void klog_release();
+/*! Number of records dropped because the ring was full */
+uint32_t klog_overflow();
+/*! Format a record for the console. Returns the length of the formatted text */
+uint32_t klog_format(const KLogRecord * r, char * buff, uint32_t size);
+/*! Write all pending records to the UART, polling (for use with interrupts disabled) */
+void klog_flush();
+
+#endif // __KLOG_H__
@@ -0,0 +1,196 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* kprintf.c
+ *
+ * Kernel formatted output (see kprintf.h.) ksnprintf has no state, so it
+ * may also be used in User-mode.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "kprintf.h"
+#include "bcm2835.h"
+
+typedef struct KOut_S {
+    char * buf;
+    uint32_t size;
+    uint32_t len;       // Length of the untruncated output
+} KOut;
+
+static inline void kout_putc(KOut * out, char ch) {
+    if(out->len+1<out->size) {
+        out->buf[out->len] = ch;
+    }
+    out->len++;
+}
+
+/*! Write the decimal digits of val backwards from end; returns the number of digits */
+static uint32_t fmt_dec(char * end, uint64_t val) {
+    char * p = end;
+    while(val>>32) {
+        uint64_t q = udiv10_u64(val);
+        *--p = '0' + (uint32_t)(val - q*10);
+        val = q;
+    }
+    uint32_t v = (uint32_t)val;
+    do {
+        uint32_t q = udiv10(v);
+        *--p = '0' + (v - q*10);
+        v = q;
+    } while(v);
+    return end-p;
+}
+
+/*! Write the hex digits of val backwards from end; returns the number of digits */
+static uint32_t fmt_hex(char * end, uint64_t val, bool upper) {
+    const char * digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char * p = end;
+    do {
+        *--p = digits[val & 0xF];
+        val >>= 4;
+    } while(val);
+    return end-p;
+}
+
+static void kout_field(KOut * out, const char * str, uint32_t len, char sign, uint32_t width, bool left, bool zero) {
+    uint32_t total = len + (sign ? 1 : 0);
+    uint32_t pad = width>total ? width-total : 0;
+    if(!left && !zero) {
+        for(; pad; pad--) {
+            kout_putc(out,' ');
+        }
+    }
+    if(sign) {
+        kout_putc(out,sign);
+    }
+    if(!left) {
+        for(; pad; pad--) {
+            kout_putc(out,'0');
+        }
+    }
+    for(uint32_t i=0; i<len; i++) {
+        kout_putc(out,str[i]);
+    }
+    for(; pad; pad--) {
+        kout_putc(out,' ');
+    }
+}
+
+uint32_t kvsnprintf(char * buf, uint32_t size, const char * fmt, va_list args) {
+    KOut out = { buf, size, 0 };
+    char num[24];
+    char * end = &num[sizeof(num)];
+    for(const char * p = fmt; *p; p++) {
+        if(*p!='%') {
+            kout_putc(&out,*p);
+            continue;
+        }
+        p++;
+        bool left = false;
+        bool zero = false;
+        for(;; p++) {
+            if(*p=='-') {
+                left = true;
+            } else if(*p=='0') {
+                zero = true;
+            } else {
+                break;
+            }
+        }
+        uint32_t width = 0;
+        for(; *p>='0' && *p<='9'; p++) {
+            width = width*10 + (*p-'0');
+        }
+        bool wide = false;
+        if(*p=='l') {
+            p++;
+            if(*p=='l') {
+                wide = true;
+                p++;
+            }
+        }
+        switch(*p) {
+        case 'd':
+        case 'i': {
+            int64_t val = wide ? va_arg(args,int64_t) : va_arg(args,int32_t);
+            uint64_t mag = val<0 ? -(uint64_t)val : (uint64_t)val;
+            uint32_t len = fmt_dec(end,mag);
+            kout_field(&out,end-len,len,val<0 ? '-' : 0,width,left,zero);
+            break;
+            }
+        case 'u': {
+            uint64_t val = wide ? va_arg(args,uint64_t) : va_arg(args,uint32_t);
+            uint32_t len = fmt_dec(end,val);
+            kout_field(&out,end-len,len,0,width,left,zero);
+            break;
+            }
+        case 'x':
+        case 'X': {
+            uint64_t val = wide ? va_arg(args,uint64_t) : va_arg(args,uint32_t);
+            uint32_t len = fmt_hex(end,val,*p=='X');
+            kout_field(&out,end-len,len,0,width,left,zero);
+            break;
+            }
+        case 'p': {
+            uint32_t len = fmt_hex(end,(uint32_t)va_arg(args,void *),false);
+            kout_putc(&out,'0');
+            kout_putc(&out,'x');
+            kout_field(&out,end-len,len,0,width,left,zero);
+            break;
+            }
+        case 'c': {
+            char ch = (char)va_arg(args,int);
+            kout_field(&out,&ch,1,0,width,left,false);
+            break;
+            }
+        case 's': {
+            const char * str = va_arg(args,const char *);
+            uint32_t len = 0;
+            while(str[len]) {
+                len++;
+            }
+            kout_field(&out,str,len,0,width,left,false);
+            break;
+            }
+        case '%':
+            kout_putc(&out,'%');
+            break;
+        default:
+            // Unknown conversion (or end of format); emit it as is
+            kout_putc(&out,'%');
+            if(!*p) {
+                p--;
+                break;
+            }
+            kout_putc(&out,*p);
+            break;
+        }
+    }
+    if(size>0) {
+        buf[out.len<size ? out.len : size-1] = 0;
+    }
+    return out.len;
+}
+
+uint32_t ksnprintf(char * buf, uint32_t size, const char * fmt, ...) {
+    va_list args;
+    va_start(args,fmt);
+    uint32_t len = kvsnprintf(buf,size,fmt,args);
+    va_end(args);
+    return len;
+}
+
+void kprintf(const char * fmt, ...) {
+    char buf[KPRINTF_BUF];
+    va_list args;
+    va_start(args,fmt);
+    uint32_t len = kvsnprintf(buf,sizeof(buf),fmt,args);
+    va_end(args);
+    if(len>=sizeof(buf)) {
+        len = sizeof(buf)-1;
+    }
+    // Buffer the whole line at once; only wait for the UART if the ring is full
+    uint32_t n = uart_write((const uint8_t *)buf,len);
+    while(n<len) {
+        uart_putc(buf[n++]);
+    }
+}
@@ -0,0 +1,50 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __KPRINTF_H__
+#define __KPRINTF_H__
+/* kprintf.h
+ *
+ * Kernel formatted output. There is no hardware divide on the ARM1176, so
+ * decimal conversion multiplies by reciprocals instead of dividing.
+ *
+ * Conversions: %d %i %u %x %X %p %c %s %%, with an optional '-' (left
+ * justify) or '0' (zero pad) flag, a field width, and 'l' (ignored) or
+ * 'll' (64-bit) length modifiers.
+ */
+#include <stdint.h>
+#include <stdarg.h>
+
+#define KPRINTF_BUF 128 // Longest kprintf output
+
+/*! Format into buf (always NUL terminated). Returns the length of the untruncated output */
+uint32_t ksnprintf(char * buf, uint32_t size, const char * fmt, ...);
+uint32_t kvsnprintf(char * buf, uint32_t size, const char * fmt, va_list args);
+/*! Format into a buffer, then write it to the console UART */
+void kprintf(const char * fmt, ...);
+
+/*! High 64 bits of the 128-bit product of a and b (four 32x32->64 bit multiplies) */
+static inline uint64_t umulh64(uint64_t a, uint64_t b) {
+    uint64_t a_lo = (uint32_t)a, a_hi = a>>32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b>>32;
+    uint64_t lo_lo = a_lo*b_lo;
+    uint64_t hi_lo = a_hi*b_lo;
+    uint64_t lo_hi = a_lo*b_hi;
+    uint64_t cross = (lo_lo>>32) + (uint32_t)hi_lo + lo_hi;
+    return a_hi*b_hi + (hi_lo>>32) + (cross>>32);
+}
+
+/*! val/10 */
+static inline uint32_t udiv10(uint32_t val) {
+    return ((uint64_t)val * 0xCCCCCCCDU) >> 35;
+}
+
+/*! val/10, for 64-bit values */
+static inline uint64_t udiv10_u64(uint64_t val) {
+    return umulh64(val,0xCCCCCCCCCCCCCCCDULL) >> 3;
+}
+
+/*! val/1000, for 64-bit values (e.g. system timer microseconds to milliseconds) */
+static inline uint64_t udiv1000_u64(uint64_t val) {
+    return umulh64(val>>3,0x20C49BA5E353F7CFULL) >> 4;
+}
+
+#endif // __KPRINTF_H__
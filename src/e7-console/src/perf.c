@@ -0,0 +1,51 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* perf.c
+ *
+ * Per-process PMU counts. Only called in Supervisor- or IRQ-mode.
+ */
+#include <stdint.h>
+#include "perf.h"
+#include "bcm2835.h"
+
+static struct {
+    uint32_t selected[PERF_EVENTS];         // Selected events
+    uint32_t cycles[SMP_CPUS];              // Cycle counter at the last charge, per core
+    uint32_t events[SMP_CPUS][PERF_EVENTS]; // Event counters at the last charge, per core
+} perf;
+
+void perf_select(uint32_t evt0, uint32_t evt1) {
+    perf.selected[0] = evt0;
+    perf.selected[1] = evt1;
+    pmu_select(evt0,evt1);
+    uint32_t cycles = cycle_counter();
+    uint32_t events[PERF_EVENTS];
+    pmu_read(&events[0],&events[1]);
+    for(int cpu=0; cpu<SMP_CPUS; cpu++) {
+        perf.cycles[cpu] = cycles;
+        for(int i=0; i<PERF_EVENTS; i++) {
+            perf.events[cpu][i] = events[i];
+        }
+    }
+    for(Process * p = p_next(0); p; p = p_next(p->pid+1)) {
+        perf_clear(&p->perf);
+        perf_clear(&p->perf_children);
+    }
+}
+
+uint32_t perf_event(uint32_t n) {
+    return perf.selected[n];
+}
+
+void perf_charge(Process * running) {
+    uint32_t cycles = cycle_counter();
+    uint32_t events[PERF_EVENTS];
+    pmu_read(&events[0],&events[1]);
+    uint32_t cpu = cpu_id();
+    // 32-bit differences are correct across counter wrap-around
+    running->perf.cycles += cycles - perf.cycles[cpu];
+    perf.cycles[cpu] = cycles;
+    for(int i=0; i<PERF_EVENTS; i++) {
+        running->perf.events[i] += events[i] - perf.events[cpu][i];
+        perf.events[cpu][i] = events[i];
+    }
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __PERF_H__
+#define __PERF_H__
+/* perf.h
+ *
+ * Per-process ARM1176 performance-monitor counts. The cycle counter and the
+ * two event count registers are free-running; on every context switch the
+ * counts since the previous switch are charged to the process that was
+ * running. (The counters are never written, since the cycle counter also
+ * timestamps trace records and SWI statistics.)
+ */
+#include <stdint.h>
+#include "proctl.h"
+
+/*! Select the PMU events, and clear the counts of all processes */
+void perf_select(uint32_t evt0, uint32_t evt1);
+/*! Returns the selected PMU event (0 or 1) */
+uint32_t perf_event(uint32_t n);
+/*! Charge the counts since the last call to the given (running) process */
+void perf_charge(Process * running);
+
+#endif // __PERF_H__
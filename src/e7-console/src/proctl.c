@@ -1,4 +1,5 @@
 // Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -7,17 +8,51 @@
 #include "bcm2835.h"
 #include "str.h"
 #include "assert.h"
+#include "klog.h"
+#include "trace.h"
 
 uint32_t _proc_main(uint32_t entrypoint, uint32_t init_param);
 
 #define MAX_MONITOR 4
 struct Monitor_S monitor_mem[MAX_MONITOR];
 
-#define MAX_PROCESS 8
+#define MAX_PROCESS (7+SMP_CPUS) // Including the idle process of each core
 struct Process_S process_mem[MAX_PROCESS];
+static ProcessStack process_stack[MAX_PROCESS] __attribute__((aligned(8)));
 
-static Queue ready_q; // ready queue
+_Static_assert(offsetof(Process,registers)==PROC_REGS_OFFSET,"start.S depends on the register-save layout");
+
+#define MAX_SEMAPHORE 8
+struct Semaphore_S semaphore_mem[MAX_SEMAPHORE];
+
+#define MAX_EVENT 4
+struct EventFlags_S event_mem[MAX_EVENT];
+
+#define MAX_TIMER 4
+struct Timer_S timer_mem[MAX_TIMER];
+
+static Process * free_p;        // free process slots (linked by q_next)
+static Queue ready_q[SMP_CPUS]; // ready queue of each core
 static Queue sleep_q; // sleep queue
+static Queue read_q;  // processes waiting for console input
+static Queue write_q; // processes waiting for console output buffer space
+static Waiter * read_any_q; // p_wait_any registrations for console input
+static Waiter * gpio_any_q; // p_wait_any registrations for GPIO events
+
+#define ANY_ALL ((uint32_t)(-1)) // Waiter mask of sources that are signalled as a whole
+
+#define GPIO_LINES 32 // GPIO bank 0
+
+static struct {
+    uint32_t events[GPIO_LINES];      // Detected events (GPIO_EVT_*)
+    uint32_t debounce_us[GPIO_LINES]; // Ignore events this soon after an accepted event
+    uint32_t last_us[GPIO_LINES];     // Time of the last accepted event
+    uint32_t accepted;                // Lines with an accepted event (last_us is valid)
+    uint32_t pending;                 // Lines with events that haven't been delivered
+    uint32_t pending_us;              // Time of the last pending event
+} gpio;
+
+static void gpio_init(void);
 
 inline static void q_init(Queue * queue) {
     queue->head = NULL;
@@ -73,34 +108,99 @@ inline static Process * q_pop(Queue * queue) {
     return popped;
 }
 
+/*! Remove a process from a queue. Returns false if it wasn't on the queue */
+inline static bool q_remove(Queue * queue, Process * remove) {
+    for(Process ** pp = &queue->head; *pp; pp = &(*pp)->q_next) {
+        if(*pp==remove) {
+            *pp = remove->q_next;
+            remove->q_next = NULL;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*! Remove all the p_wait_any registrations of a process, and cancel its timeout */
+static void any_cancel(Process * p) {
+    for(uint32_t i=0; i<p->wait.any.count; i++) {
+        Waiter * w = &p->wait.any.reg[i];
+        for(Waiter ** ww = w->list; ww && *ww; ww = &(*ww)->next) {
+            if(*ww==w) {
+                *ww = w->next;
+                break;
+            }
+        }
+        w->list = NULL;
+    }
+    q_remove(&sleep_q,p);
+}
+
+/*! Wake a process in p_wait_any; it resumes with the index of the ready source */
+static void any_wake(Process * p, uint32_t index) {
+    any_cancel(p);
+    p->registers[R_R0] = index;
+    p_ready(p);
+}
+
+/*! Wake the processes registered on a wait list for any of the given bits */
+static void any_notify(Waiter ** list, uint32_t bits) {
+    Waiter * w = *list;
+    while(w) {
+        if(w->mask & bits) {
+            any_wake(w->p,w - w->p->wait.any.reg);
+            w = *list; // all the registrations of the process are gone
+        } else {
+            w = w->next;
+        }
+    }
+}
+
 void p_init() {
-    for(int pid=0; pid<MAX_PROCESS; pid++) {
+    free_p = NULL;
+    for(int pid=MAX_PROCESS-1; pid>=0; pid--) {
         process_mem[pid].flags = 0;
+        process_mem[pid].q_next = free_p;
+        free_p = &process_mem[pid];
+    }
+    for(int cpu=0; cpu<SMP_CPUS; cpu++) {
+        q_init(&ready_q[cpu]);
     }
-    q_init(&ready_q);
     q_init(&sleep_q);
+    q_init(&read_q);
+    q_init(&write_q);
+    read_any_q = NULL;
+    gpio_any_q = NULL;
+    gpio_init();
 
     for(int mid=0; mid<MAX_MONITOR; mid++) {
         monitor_mem[mid].flags = 0;
     }
+    for(int sid=0; sid<MAX_SEMAPHORE; sid++) {
+        semaphore_mem[sid].flags = 0;
+    }
+    for(int eid=0; eid<MAX_EVENT; eid++) {
+        event_mem[eid].flags = 0;
+    }
+    for(int tid=0; tid<MAX_TIMER; tid++) {
+        timer_mem[tid].flags = 0;
+    }
 }
 
 Process * p_create(const Process * parent, uint32_t entry_point, uint32_t init_param, uint32_t priority) {
-    // find a free process struct
-    int32_t pid = 0;
-    for(; pid<MAX_PROCESS; pid++) {
-        if(process_mem[pid].flags==0) {
-            break;
-        }
+    // take a free process struct
+    Process * p = free_p;
+    if(!p) {
+        return NULL;
     }
-    ASSERT(pid<MAX_PROCESS,FC_OUT_OF_PROC)
-    Process * p = &process_mem[pid];
+    free_p = p->q_next;
+    uint32_t pid = p - process_mem;
     for(int i=0; i<MAX_REGISTERS;i++) {
         p->registers[i] = 0;
     }
     p->registers[R_R0] = (uint32_t)entry_point;
     p->registers[R_R1] = init_param;
-    p->registers[R_SP] = (uint32_t)&(p->stack_mem[STACK_SIZE]);
+    p->stack = &process_stack[pid];
+    p->registers[R_SP] = (uint32_t)&(p->stack->mem[STACK_SIZE]);
     p->ps = CPSR_MODE_USR | CPSR_DISABLE_FIQ;
     p->pc = (uint32_t)_proc_main;
     p->pid = pid;
@@ -111,53 +211,228 @@ Process * p_create(const Process * parent, uint32_t entry_point, uint32_t init_p
     }
     p->flags = P_ALLOCATED;
     p->sched_prio = priority;
-    p->stack_magic = STACK_MAGIC;
+    p->cpu = cpu_id();
+    p->affinity = CPU_ANY;
+    p->state = PS_READY;
+    p->wait_id = 0;
+    p->ticks = 0;
+    p->switches = 0;
+    perf_clear(&p->perf);
+    perf_clear(&p->perf_children);
+    p->ring = NULL;
+    p->ring_flags = 0;
+    p->stack->magic = STACK_MAGIC;
     p->magic = PROC_MAGIC;
     p->q_next = NULL;
-    char buff[32];
-    uart_puts("creating process: pid=");
-    uart_puts(itoa(p->pid,buff,10));
-    uart_puts("\r\n");
-    for(int r=0;r<MAX_REGISTERS;r++) {
-        if(r!=0) {
-            uart_puts(" ");
-        }
-        uart_puts("r");
-        uart_puts(itoa(r,buff,10));
-        uart_puts("=");
-        uart_puts(itoa(p->registers[r],buff,16));
-    }
-    uart_puts("\r\n");
+    klog(KLOG_INFO,p->pid,"process created");
+    if(KLOG_ENABLED(KLOG_DEBUG)) {
+        // Initial register values
+        for(int r=0;r<MAX_REGISTERS;r+=3) {
+            KLogRecord * rec = klog_begin(KLOG_DEBUG,p->pid);
+            for(int i=r;i<r+3 && i<MAX_REGISTERS;i++) {
+                klog_str(rec," r");
+                klog_num(rec,i,10);
+                klog_str(rec,"=");
+                klog_num(rec,p->registers[i],16);
+            }
+            klog_commit(rec);
+        }
+    }
     return p;
 }
 
+void p_pin(Process * p, uint32_t cpu) {
+    ASSERT(cpu<SMP_CPUS,FC_ILLEGAL_ARG)
+    p->cpu = cpu;
+    p->affinity = cpu;
+}
+
+#if SMP_CPUS>1
+static uint32_t idle_cpus; // Cores that are running their idle process
+
+/*! Interrupt a core that should pick up a process that was just made ready */
+static void p_kick(const Process * p) {
+    // The calling core reschedules on its own
+    uint32_t idle = idle_cpus & ~(1<<cpu_id());
+    if(idle & (1<<p->cpu)) {
+        ipi_send(p->cpu);
+    } else if(idle && p->affinity==CPU_ANY) {
+        ipi_send(__builtin_ctz(idle)); // It will steal the process
+    }
+}
+
+uint32_t p_busy_cpus(void) {
+    return ((1<<SMP_CPUS)-1) & ~idle_cpus;
+}
+
+/*! Take an unpinned process from the ready queue of another core */
+static Process * p_steal(uint32_t cpu) {
+    for(uint32_t i=1; i<SMP_CPUS; i++) {
+        Queue * q = &ready_q[(cpu+i) % SMP_CPUS];
+        for(Process * p = q->head; p; p = p->q_next) {
+            if(p->affinity==CPU_ANY && !(p->flags & P_IDLE)) {
+                q_remove(q,p);
+                p->cpu = cpu;
+                return p;
+            }
+        }
+    }
+    return NULL;
+}
+#endif
+
 void p_ready(Process * insert) {
-    q_insert_uint32(&ready_q, insert, insert->sched_prio);
+    insert->state = PS_READY;
+    q_insert_uint32(&ready_q[insert->cpu], insert, insert->sched_prio);
+#if SMP_CPUS>1
+    p_kick(insert);
+#endif
 }
 
 Process * p_pop_ready() {
-    Process * p = q_pop(&ready_q);
+    uint32_t cpu = cpu_id();
+    Process * p = NULL;
+#if SMP_CPUS>1
+    // Steal work rather than go idle
+    Process * head = ready_q[cpu].head;
+    if(!head || (head->flags & P_IDLE)) {
+        p = p_steal(cpu);
+    }
+#endif
+    if(!p) {
+        p = q_pop(&ready_q[cpu]);
+    }
     ASSERT(p,FC_EMPTY_QUEUE)
+#if SMP_CPUS>1
+    if(p->flags & P_IDLE) {
+        idle_cpus |= 1<<cpu;
+    } else {
+        idle_cpus &= ~(1<<cpu);
+    }
+#endif
+    p->state = PS_RUNNING;
     return p;
 }
 
+Process * p_next(uint32_t pid) {
+    for(; pid<MAX_PROCESS; pid++) {
+        if(process_mem[pid].flags & P_ALLOCATED) {
+            return &process_mem[pid];
+        }
+    }
+    return NULL;
+}
+
+/*! Return a process slot to the free list */
+static void p_free(Process * p) {
+    p->flags = 0;
+    p->q_next = free_p;
+    free_p = p;
+}
+
+/*! Reap a terminated child; charge its counts to the parent, and recycle its process slot */
+static void p_reap(Process * parent, Process * child) {
+    perf_add(&parent->perf_children,&child->perf);
+    perf_add(&parent->perf_children,&child->perf_children);
+    p_free(child);
+}
+
 void p_terminate(Process * running, uint32_t exit_code) {
     ASSERT(running->magic==PROC_MAGIC,FC_INVALID_PROC_MAGIC)
     ASSERT(running->q_next==NULL,FC_INVALID_PROC_STATE)
-    uart_puts("Process has terminated: pid=");
-    uart_putn(running->pid);
-    uart_puts(", exit_code=");
-    uart_putn(exit_code);
-    uart_puts("\r\n");
+    KLogRecord * r = klog_begin(KLOG_INFO,running->pid);
+    klog_str(r,"process terminated, exit_code=");
+    klog_num(r,exit_code,10);
+    klog_commit(r);
 
     running->exit_code = exit_code;
     running->flags |= P_TERMINATED;
+    running->ring = NULL; // Not polled once the process is gone
+
+    // Reparent children; terminated children can no longer be waited for
+    for(int pid=0; pid<MAX_PROCESS; pid++) {
+        Process * child = &process_mem[pid];
+        if((child->flags & P_ALLOCATED) && child->parent_pid==running->pid) {
+            child->parent_pid = PID_NONE;
+            if(child->flags & P_ZOMBIE) {
+                p_free(child);
+            }
+        }
+    }
+
+    if(running->parent_pid==PID_NONE) {
+        // No one to report to; recycle the process slot immediately
+        p_free(running);
+        return;
+    }
+    Process * parent = &process_mem[running->parent_pid];
+    ASSERT(parent->flags & P_ALLOCATED,FC_INVALID_PROC_STATE)
+    if((parent->flags & P_WAITING)
+        && (parent->wait.child.pid==PID_ANY || parent->wait.child.pid==running->pid)) {
+        // Parent is already waiting for this process
+        if(parent->wait.child.exit_code) {
+            *parent->wait.child.exit_code = exit_code;
+        }
+        parent->flags &= ~P_WAITING;
+        parent->registers[R_R0] = running->pid;
+        p_ready(parent);
+        p_reap(parent,running);
+        return;
+    }
+    running->flags |= P_ZOMBIE;
+    running->state = PS_ZOMBIE;
+    if(parent->state==PS_ANY) {
+        // The parent is the wait list of its children
+        for(uint32_t i=0; i<parent->wait.any.count; i++) {
+            const WaitSpec * src = &parent->wait.any.src[i];
+            if(src->type==WAIT_SRC_CHILD && (src->id==PID_ANY || src->id==running->pid)) {
+                any_wake(parent,i);
+                break;
+            }
+        }
+    }
+}
+
+uint32_t p_wait(Process * p, uint32_t pid, uint32_t * exit_code, uint32_t options) {
+    bool has_child = false;
+    for(int cpid=0; cpid<MAX_PROCESS; cpid++) {
+        Process * child = &process_mem[cpid];
+        if(!(child->flags & P_ALLOCATED) || child->parent_pid!=p->pid) {
+            continue;
+        }
+        if(pid!=PID_ANY && pid!=child->pid) {
+            continue;
+        }
+        if(child->flags & P_ZOMBIE) {
+            // Reap the child, and recycle its process slot
+            if(exit_code) {
+                *exit_code = child->exit_code;
+            }
+            p_reap(p,child);
+            return child->pid;
+        }
+        has_child = true;
+    }
+    if(!has_child) {
+        return W_NO_CHILD;
+    }
+    if(options & WAIT_NOHANG) {
+        return W_RUNNING;
+    }
+    p->wait.child.pid = pid;
+    p->wait.child.exit_code = exit_code;
+    p->flags |= P_WAITING;
+    p->state = PS_CHILD;
+    p->wait_id = pid;
+    return W_BLOCKED;
 }
 
 /*! Insert the given process into the sleep queue.
  *
  */
  void p_sleep(Process * running, uint64_t sleep_until) {
+    TRACE(TR_SLEEP,running->pid,0)
+    running->state = PS_SLEEPING;
     q_insert_uint64(&sleep_q, running, sleep_until);
 }
 
@@ -167,7 +442,12 @@ void p_terminate(Process * running, uint32_t exit_code) {
 void p_rouse(uint64_t clock) {
     while(sleep_q.head && sleep_q.head->q_prio_uint64 <= clock) {
         Process * p = q_pop(&sleep_q);
-        q_insert_uint32(&ready_q,p,p->sched_prio);
+        TRACE(TR_ROUSE,p->pid,0)
+        if(p->state==PS_ANY) {
+            any_wake(p,p->wait.any.timeout);
+        } else {
+            p_ready(p);
+        }
     }
 }
 
@@ -183,6 +463,7 @@ uint32_t m_create() {
     Monitor * m = &monitor_mem[mid];
     q_init(&m->entry_q);
     q_init(&m->cond_q);
+    m->any_q = NULL;
     m->p = NULL;
     m->mid = mid;
     m->flags = M_ALLOCATED;
@@ -203,6 +484,7 @@ static void next_ready(Monitor * m) {
         // No one waiting to enter
         m->p = NULL;
         m->flags &= ~M_OCCUPIED;
+        any_notify(&m->any_q,ANY_ALL);
     } else {
         m->p = ready;
         p_ready(ready);
@@ -210,6 +492,7 @@ static void next_ready(Monitor * m) {
 }
 
 int m_enter(Process * p, uint32_t mid) {
+    TRACE(TR_MON_ENTER,p->pid,mid)
     Monitor * m = m_lookup(mid);
     if(!m) {
         ASSERT(false,FC_ILLEGAL_ARG)
@@ -226,11 +509,14 @@ int m_enter(Process * p, uint32_t mid) {
     // There's already a process in the monitor (thou shall not pass)
     // Add the process to entry queue
     // NOTE: currently using process scheduling priority as the monitor priority
+    p->state = PS_MON_ENTER;
+    p->wait_id = mid;
     q_insert_uint32(&m->entry_q,p,p->sched_prio);
     return M_BLOCKED;
 }
 
 int m_exit(Process * p, uint32_t mid) {
+    TRACE(TR_MON_EXIT,p->pid,mid)
     Monitor * m = m_lookup(mid);
     if(!m) {
         // TODO: set error code
@@ -249,6 +535,7 @@ int m_exit(Process * p, uint32_t mid) {
 }
 
 int m_wait(Process * p, uint32_t mid) {
+    TRACE(TR_MON_WAIT,p->pid,mid)
     Monitor * m = m_lookup(mid);
     if(!m) {
         ASSERT(false,FC_ILLEGAL_ARG)
@@ -262,12 +549,15 @@ int m_wait(Process * p, uint32_t mid) {
     }
     // insert into condition queue
     // NOTE: currently using process priority as cond priority
+    p->state = PS_MON_WAIT;
+    p->wait_id = mid;
     q_insert_uint32(&m->cond_q,p,p->sched_prio);
     next_ready(m);
     return M_BLOCKED; 
 }
 
 int m_notify(Process * p, uint32_t mid) {
+    TRACE(TR_MON_NOTIFY,p->pid,mid)
     Monitor * m = m_lookup(mid);
     if(!m) {
         ASSERT(false,FC_ILLEGAL_ARG)
@@ -283,7 +573,546 @@ int m_notify(Process * p, uint32_t mid) {
     if(waiting) {
         // Wake-up a the waiting process
         // NOTE: currently using process priority as entry priority
+        waiting->state = PS_MON_ENTER;
         q_insert_uint32(&m->entry_q,waiting,waiting->sched_prio);
     }
     return M_OK;
 }
+
+uint32_t sem_create(uint32_t count) {
+    // find a free semaphore struct
+    int32_t sid = 0;
+    for(; sid<MAX_SEMAPHORE; sid++) {
+        if(semaphore_mem[sid].flags==0) {
+            break;
+        }
+    }
+    ASSERT(sid<MAX_SEMAPHORE,FC_OUT_OF_SEM)
+    Semaphore * s = &semaphore_mem[sid];
+    q_init(&s->wait_q);
+    s->any_q = NULL;
+    s->count = count;
+    s->sid = sid;
+    s->flags = S_ALLOCATED;
+    return s->sid;
+}
+
+static Semaphore * sem_lookup(uint32_t sid) {
+    if(sid>=MAX_SEMAPHORE) {
+        return NULL;
+    }
+    Semaphore * s = &semaphore_mem[sid];
+    return (s->flags & S_ALLOCATED) ? s : NULL;
+}
+
+int sem_wait(Process * p, uint32_t sid) {
+    Semaphore * s = sem_lookup(sid);
+    if(!s) {
+        ASSERT(false,FC_ILLEGAL_ARG)
+        return M_ILLEGAL_ARG;
+    }
+    if(s->count>0) {
+        s->count--;
+        return M_OK;
+    }
+    // NOTE: currently using process scheduling priority as the semaphore priority
+    p->state = PS_SEM;
+    p->wait_id = sid;
+    q_insert_uint32(&s->wait_q,p,p->sched_prio);
+    return M_BLOCKED;
+}
+
+int sem_signal(uint32_t sid) {
+    Semaphore * s = sem_lookup(sid);
+    if(!s) {
+        ASSERT(false,FC_ILLEGAL_ARG)
+        return M_ILLEGAL_ARG;
+    }
+    Process * waiting = q_pop(&s->wait_q);
+    if(waiting) {
+        // Hand the signal directly to the waiting process; the count stays at zero
+        waiting->registers[R_R0] = M_OK;
+        p_ready(waiting);
+    } else {
+        s->count++;
+        any_notify(&s->any_q,ANY_ALL);
+    }
+    return M_OK;
+}
+
+uint32_t evt_create() {
+    // find a free event flag group struct
+    int32_t eid = 0;
+    for(; eid<MAX_EVENT; eid++) {
+        if(event_mem[eid].flags==0) {
+            break;
+        }
+    }
+    ASSERT(eid<MAX_EVENT,FC_OUT_OF_EVT)
+    EventFlags * e = &event_mem[eid];
+    q_init(&e->wait_q);
+    e->any_q = NULL;
+    e->events = 0;
+    e->eid = eid;
+    e->flags = E_ALLOCATED;
+    return e->eid;
+}
+
+static EventFlags * evt_lookup(uint32_t eid) {
+    if(eid>=MAX_EVENT) {
+        return NULL;
+    }
+    EventFlags * e = &event_mem[eid];
+    return (e->flags & E_ALLOCATED) ? e : NULL;
+}
+
+/*! Returns the flags that satisfy the wait, or 0 if the wait is not (yet) satisfied */
+static uint32_t evt_match(EventFlags * e, uint32_t mask, uint32_t mode) {
+    uint32_t matched = e->events & mask;
+    if(mode & EVT_WAIT_ALL) {
+        return (matched==mask) ? matched : 0;
+    }
+    return matched;
+}
+
+uint32_t evt_wait(Process * p, uint32_t eid, uint32_t mask, uint32_t mode) {
+    EventFlags * e = evt_lookup(eid);
+    if(!e || mask==0) {
+        ASSERT(false,FC_ILLEGAL_ARG)
+        return 0;
+    }
+    uint32_t matched = evt_match(e,mask,mode);
+    if(matched) {
+        if(mode & EVT_CONSUME) {
+            e->events &= ~matched;
+        }
+        return matched;
+    }
+    p->wait.evt.mask = mask;
+    p->wait.evt.mode = mode;
+    p->state = PS_EVT;
+    p->wait_id = eid;
+    q_insert_uint32(&e->wait_q,p,p->sched_prio);
+    return 0;
+}
+
+int evt_set(uint32_t eid, uint32_t mask) {
+    EventFlags * e = evt_lookup(eid);
+    if(!e) {
+        ASSERT(false,FC_ILLEGAL_ARG)
+        return M_ILLEGAL_ARG;
+    }
+    e->events |= mask;
+    // Wake-up every waiting process whose wait is now satisfied (in priority order)
+    Process * prev = NULL;
+    for(Process * p = e->wait_q.head; p; ) {
+        Process * next = p->q_next;
+        uint32_t matched = evt_match(e,p->wait.evt.mask,p->wait.evt.mode);
+        if(matched) {
+            if(prev) {
+                prev->q_next = next;
+            } else {
+                e->wait_q.head = next;
+            }
+            p->q_next = NULL;
+            if(p->wait.evt.mode & EVT_CONSUME) {
+                e->events &= ~matched;
+            }
+            p->registers[R_R0] = matched;
+            p_ready(p);
+        } else {
+            prev = p;
+        }
+        p = next;
+    }
+    any_notify(&e->any_q,e->events);
+    return M_OK;
+}
+
+int evt_clear(uint32_t eid, uint32_t mask) {
+    EventFlags * e = evt_lookup(eid);
+    if(!e) {
+        ASSERT(false,FC_ILLEGAL_ARG)
+        return M_ILLEGAL_ARG;
+    }
+    e->events &= ~mask;
+    return M_OK;
+}
+
+uint32_t tmr_create(uint32_t period_us, uint64_t now) {
+    // find a free timer struct
+    int32_t tid = 0;
+    for(; tid<MAX_TIMER; tid++) {
+        if(timer_mem[tid].flags==0) {
+            break;
+        }
+    }
+    ASSERT(tid<MAX_TIMER,FC_OUT_OF_TIMER)
+    ASSERT(period_us>0,FC_ILLEGAL_ARG)
+    Timer * t = &timer_mem[tid];
+    t->period = period_us;
+    t->expiry = now + period_us;
+    t->tid = tid;
+    t->flags = T_ALLOCATED;
+    return t->tid;
+}
+
+static Timer * tmr_lookup(uint32_t tid) {
+    if(tid>=MAX_TIMER) {
+        return NULL;
+    }
+    Timer * t = &timer_mem[tid];
+    return (t->flags & T_ALLOCATED) ? t : NULL;
+}
+
+uint32_t tmr_wait(Process * p, uint32_t tid, uint64_t now) {
+    Timer * t = tmr_lookup(tid);
+    if(!t) {
+        ASSERT(false,FC_ILLEGAL_ARG)
+        return T_ILLEGAL_ARG;
+    }
+    if(now<t->expiry) {
+        p_sleep(p,t->expiry);
+        t->expiry += t->period;
+        return T_BLOCKED;
+    }
+    // Late: skip to the latest period start (64-bit division only on this path)
+    uint32_t overruns = (now - t->expiry) / t->period;
+    t->expiry += (uint64_t)(overruns+1) * t->period;
+    return overruns;
+}
+
+void ring_setup(Process * p, Ring * ring, uint32_t flags) {
+    if(ring) {
+        ring->sq_head = 0;
+        ring->sq_tail = 0;
+        ring->cq_head = 0;
+        ring->cq_tail = 0;
+    }
+    p->ring = ring;
+    p->ring_flags = flags;
+}
+
+/*! Process the posted operations of a process; a polled ring stops at a monitor notify */
+static uint32_t ring_drain(Process * p, bool polled) {
+    Ring * ring = p->ring;
+    uint32_t tail = ring->sq_tail;
+    if(tail - ring->sq_head > RING_ENTRIES) {
+        return 0; // sq_tail has been trashed
+    }
+    MEMORY_BARRIER(); // Read the entries after the tail that covers them
+    uint32_t n = 0;
+    while(ring->sq_head!=tail && ring->cq_tail - ring->cq_head < RING_ENTRIES) {
+        const RingSubmit * sqe = &ring->sq[ring->sq_head & (RING_ENTRIES-1)];
+        if(polled && sqe->op==RING_OP_MON_NOTIFY) {
+            break;
+        }
+        uint32_t res = 0;
+        switch(sqe->op) {
+        case RING_OP_NOP:
+            break;
+        case RING_OP_SET_LED:
+            gpio_write(sqe->arg[0],sqe->arg[1]);
+            break;
+        case RING_OP_GPIO_WRITE_MASK:
+            res = gpio_write_mask(sqe->arg[0],sqe->arg[1],sqe->arg[2]);
+            break;
+        case RING_OP_LOG:
+            klog(KLOG_INFO,p->pid,(const char *)sqe->arg[0]);
+            break;
+        case RING_OP_EVT_SET:
+            res = evt_set(sqe->arg[0],sqe->arg[1]);
+            break;
+        case RING_OP_SEM_SIGNAL:
+            res = sem_signal(sqe->arg[0]);
+            break;
+        case RING_OP_MON_NOTIFY:
+            res = m_notify(p,sqe->arg[0]);
+            break;
+        default:
+            res = RING_ILLEGAL_OP;
+            break;
+        }
+        RingComplete * cqe = &ring->cq[ring->cq_tail & (RING_ENTRIES-1)];
+        cqe->user_data = sqe->user_data;
+        cqe->res = res;
+        MEMORY_BARRIER(); // Done with the entry, and the completion is written
+        ring->sq_head++;
+        ring->cq_tail++;
+        n++;
+    }
+    return n;
+}
+
+uint32_t ring_enter(Process * p) {
+    return p->ring ? ring_drain(p,false) : 0;
+}
+
+uint32_t ring_poll(void) {
+    uint32_t n = 0;
+    for(int pid=0; pid<MAX_PROCESS; pid++) {
+        Process * p = &process_mem[pid];
+        if((p->flags & P_ALLOCATED) && p->ring && (p->ring_flags & RING_POLL)) {
+            n += ring_drain(p,true);
+        }
+    }
+    return n;
+}
+
+uint32_t io_read(Process * p, uint8_t * buf, uint32_t len) {
+    uint32_t n = uart_read(buf,len);
+    if(n>0 || len==0) {
+        return n;
+    }
+    p->wait.io.buf = buf;
+    p->wait.io.len = len;
+    p->wait.io.done = 0;
+    p->state = PS_READ;
+    q_insert_uint32(&read_q,p,p->sched_prio);
+    return IO_BLOCKED;
+}
+
+uint32_t io_write(Process * p, const uint8_t * buf, uint32_t len) {
+    uint32_t n = uart_write(buf,len);
+    if(n==len) {
+        return n;
+    }
+    p->wait.io.buf = (uint8_t *)buf;
+    p->wait.io.len = len;
+    p->wait.io.done = n;
+    p->state = PS_WRITE;
+    q_insert_uint32(&write_q,p,p->sched_prio);
+    return IO_BLOCKED;
+}
+
+void io_rx_ready() {
+    while(read_q.head) {
+        Process * p = read_q.head;
+        uint32_t n = uart_read(p->wait.io.buf,p->wait.io.len);
+        if(n==0) {
+            break;
+        }
+        q_pop(&read_q);
+        p->registers[R_R0] = n;
+        p_ready(p);
+    }
+    if(uart_rx_count()) {
+        any_notify(&read_any_q,ANY_ALL);
+    }
+}
+
+void io_tx_ready() {
+    while(write_q.head) {
+        Process * p = write_q.head;
+        p->wait.io.done += uart_write(p->wait.io.buf+p->wait.io.done,p->wait.io.len-p->wait.io.done);
+        if(p->wait.io.done<p->wait.io.len) {
+            break;
+        }
+        q_pop(&write_q);
+        p->registers[R_R0] = p->wait.io.len;
+        p_ready(p);
+    }
+}
+
+static void gpio_init(void) {
+    for(int i=0; i<GPIO_LINES; i++) {
+        gpio.events[i] = 0;
+        gpio.debounce_us[i] = 0;
+    }
+    gpio.pending = 0;
+    gpio.accepted = 0;
+}
+
+uint32_t gpio_configure(uint32_t gpio_line, uint32_t events, uint32_t debounce_us) {
+    if(gpio_line>=GPIO_LINES) {
+        return 1;
+    }
+    gpio_set_func(gpio_line,GPF_INPUT);
+    gpio.events[gpio_line] = events;
+    gpio.debounce_us[gpio_line] = debounce_us;
+    gpio.pending &= ~(1<<gpio_line);
+    gpio.accepted &= ~(1<<gpio_line);
+    return gpio_irq_config(gpio_line,events);
+}
+
+uint32_t gpio_wait(Process * p, uint32_t mask, uint64_t deadline, uint32_t * timestamp) {
+    // Re-arm level detection, which is disabled after each level event
+    for(int i=0; i<GPIO_LINES; i++) {
+        if((mask & (1<<i)) && (gpio.events[i] & GPIO_EVT_LEVEL) && !(gpio.pending & (1<<i))) {
+            gpio_irq_config(i,gpio.events[i]);
+        }
+    }
+    uint32_t lines = gpio.pending & mask;
+    if(lines) {
+        gpio.pending &= ~lines;
+        if(timestamp) {
+            *timestamp = gpio.pending_us;
+        }
+        return lines;
+    }
+    p->wait.gpio.mask = mask;
+    p->wait.gpio.timestamp = timestamp;
+    p->state = PS_GPIO;
+    p->wait_id = mask;
+    if(deadline) {
+        q_insert_uint64(&sleep_q,p,deadline);
+    }
+    return 0;
+}
+
+void gpio_events(uint32_t events, uint32_t now_us) {
+    // Debounce
+    for(int i=0; i<GPIO_LINES; i++) {
+        if(events & (1<<i)) {
+            if((gpio.accepted & (1<<i)) && now_us-gpio.last_us[i] < gpio.debounce_us[i]) {
+                events &= ~(1<<i);
+            } else {
+                gpio.last_us[i] = now_us;
+                gpio.accepted |= 1<<i;
+            }
+        }
+    }
+    if(!events) {
+        return;
+    }
+    // Wake up every process waiting for one of the lines
+    uint32_t delivered = 0;
+    for(int pid=0; pid<MAX_PROCESS; pid++) {
+        Process * p = &process_mem[pid];
+        if(!(p->flags & P_ALLOCATED) || p->state!=PS_GPIO || !(p->wait.gpio.mask & events)) {
+            continue;
+        }
+        q_remove(&sleep_q,p); // cancel the timeout
+        if(p->wait.gpio.timestamp) {
+            *p->wait.gpio.timestamp = now_us;
+        }
+        p->registers[R_R0] = p->wait.gpio.mask & events;
+        delivered |= p->wait.gpio.mask & events;
+        p_ready(p);
+    }
+    // Keep the rest until someone waits for them
+    if(events & ~delivered) {
+        gpio.pending |= events & ~delivered;
+        gpio.pending_us = now_us;
+        any_notify(&gpio_any_q,events & ~delivered);
+    }
+}
+
+/*! Returns true if p_wait would return without blocking for the given child */
+static bool p_child_ready(const Process * p, uint32_t pid) {
+    // Ready if a matching child can be reaped, or if there is none (p_wait returns W_NO_CHILD)
+    bool running = false;
+    for(int cpid=0; cpid<MAX_PROCESS; cpid++) {
+        const Process * child = &process_mem[cpid];
+        if((child->flags & P_ALLOCATED) && child->parent_pid==p->pid
+            && (pid==PID_ANY || pid==child->pid)) {
+            if(child->flags & P_ZOMBIE) {
+                return true;
+            }
+            running = true;
+        }
+    }
+    return !running;
+}
+
+uint32_t p_wait_any(Process * p, const WaitSpec * sources, uint32_t count, uint64_t now) {
+    if(count==0 || count>WAIT_ANY_MAX) {
+        return WAIT_ANY_ILLEGAL;
+    }
+    // Return the first source that is ready; find the wait list of each of the others
+    uint64_t deadline = 0;
+    for(uint32_t i=0; i<count; i++) {
+        const WaitSpec * src = &sources[i];
+        Waiter * w = &p->wait.any.reg[i];
+        w->p = p;
+        w->list = NULL;
+        w->mask = ANY_ALL;
+        switch(src->type) {
+        case WAIT_SRC_MON: {
+            Monitor * m = m_lookup(src->id);
+            if(!m) {
+                return WAIT_ANY_ILLEGAL;
+            }
+            if(!(m->flags & M_OCCUPIED)) {
+                return i;
+            }
+            w->list = &m->any_q;
+            break;
+            }
+        case WAIT_SRC_SEM: {
+            Semaphore * s = sem_lookup(src->id);
+            if(!s) {
+                return WAIT_ANY_ILLEGAL;
+            }
+            if(s->count>0) {
+                return i;
+            }
+            w->list = &s->any_q;
+            break;
+            }
+        case WAIT_SRC_EVT: {
+            EventFlags * e = evt_lookup(src->id);
+            if(!e || src->mask==0) {
+                return WAIT_ANY_ILLEGAL;
+            }
+            if(e->events & src->mask) {
+                return i;
+            }
+            w->list = &e->any_q;
+            w->mask = src->mask;
+            break;
+            }
+        case WAIT_SRC_READ:
+            if(uart_rx_count()) {
+                return i;
+            }
+            w->list = &read_any_q;
+            break;
+        case WAIT_SRC_GPIO:
+            if(src->mask==0) {
+                return WAIT_ANY_ILLEGAL;
+            }
+            if(gpio.pending & src->mask) {
+                return i;
+            }
+            w->list = &gpio_any_q;
+            w->mask = src->mask;
+            break;
+        case WAIT_SRC_CHILD:
+            // Not on a list; p_terminate checks the parent's sources
+            if(p_child_ready(p,src->id)) {
+                return i;
+            }
+            break;
+        case WAIT_SRC_TIMEOUT: {
+            if(src->id==0) {
+                return i;
+            }
+            uint64_t t = now + (uint64_t)1000 * src->id;
+            if(!deadline || t<deadline) {
+                deadline = t;
+                p->wait.any.timeout = i;
+            }
+            break;
+            }
+        default:
+            return WAIT_ANY_ILLEGAL;
+        }
+    }
+    // Nothing is ready; register on every wait list
+    for(uint32_t i=0; i<count; i++) {
+        p->wait.any.src[i] = sources[i];
+        Waiter * w = &p->wait.any.reg[i];
+        if(w->list) {
+            w->next = *w->list;
+            *w->list = w;
+        }
+    }
+    p->wait.any.count = count;
+    p->state = PS_ANY;
+    p->wait_id = count;
+    if(deadline) {
+        q_insert_uint64(&sleep_q,p,deadline);
+    }
+    return WAIT_ANY_BLOCKED;
+}
@@ -2,10 +2,31 @@
 #ifndef __PROCTL_H__
 #define __PROCTL_H__
 #include <stdint.h>
+#include "ring.h"
 
 // Process flags
 #define P_ALLOCATED  0b00000001 // Process control struct is in use
 #define P_TERMINATED 0b00000010 // Process has terminated
+#define P_ZOMBIE     0b00000100 // Process has terminated, but has not yet been reaped by its parent
+#define P_WAITING    0b00001000 // Process is waiting for a child process to terminate
+#define P_IDLE       0b00010000 // Idle process of a core (see p_pin)
+
+#define CPU_ANY ((uint32_t)(-1)) // Process may run on any core
+
+// Process states (what the process is doing, or which queue it is blocked on)
+#define PS_RUNNING   0  // Running
+#define PS_READY     1  // On the ready queue
+#define PS_SLEEPING  2  // On the sleep queue
+#define PS_MON_ENTER 3  // On a monitor's entry queue; wait_id = mid
+#define PS_MON_WAIT  4  // On a monitor's condition queue; wait_id = mid
+#define PS_SEM       5  // On a semaphore's wait queue; wait_id = sid
+#define PS_EVT       6  // On an event flag group's wait queue; wait_id = eid
+#define PS_CHILD     7  // Waiting for a child process; wait_id = pid (or PID_ANY)
+#define PS_READ      8  // Waiting for console input
+#define PS_WRITE     9  // Waiting for console output buffer space
+#define PS_ZOMBIE    10 // Terminated, not yet reaped
+#define PS_GPIO      11 // Waiting for GPIO events; wait_id = pin mask
+#define PS_ANY       12 // Waiting for any of several event sources; wait_id = number of sources
 
 #define MAX_REGISTERS 15
 struct Monitor_S;
@@ -15,43 +36,198 @@ typedef struct Queue_S {
     struct Process_S * head;
 } Queue;
 
-#define STACK_SIZE 0x10
+#define STACK_SIZE 0x400 // words
 #define PID_NONE ((uint32_t)(-1))
+#define PID_ANY  ((uint32_t)(-2))
+
+#define PERF_EVENTS 2 // ARM1176 event count registers
+
+/*! Performance-monitor counts charged to a process (see perf.h) */
+typedef struct PerfCount_S {
+    uint64_t cycles;
+    uint32_t events[PERF_EVENTS];
+} PerfCount;
+
+static inline void perf_clear(PerfCount * c) {
+    c->cycles = 0;
+    for(int i=0; i<PERF_EVENTS; i++) {
+        c->events[i] = 0;
+    }
+}
+
+static inline void perf_add(PerfCount * to, const PerfCount * from) {
+    to->cycles += from->cycles;
+    for(int i=0; i<PERF_EVENTS; i++) {
+        to->events[i] += from->events[i];
+    }
+}
+
+// Event sources of p_wait_any (same values as WAIT_SRC_* in toast.h)
+#define WAIT_SRC_MON     1 // Monitor is free; id = mid
+#define WAIT_SRC_SEM     2 // Semaphore count is non-zero; id = sid
+#define WAIT_SRC_EVT     3 // Any of the event flags in mask are set; id = eid
+#define WAIT_SRC_READ    4 // Console input is available
+#define WAIT_SRC_GPIO    5 // Event on any of the GPIO lines (bank 0) in mask
+#define WAIT_SRC_CHILD   6 // Child process has terminated; id = pid (or PID_ANY)
+#define WAIT_SRC_TIMEOUT 7 // Timeout; id = milliseconds
+
+#define WAIT_ANY_MAX 4 // Event sources per p_wait_any
+
+/*! An event source of p_wait_any (same layout as WaitSource in toast.h) */
+typedef struct WaitSpec_S {
+    uint32_t type;                     // WAIT_SRC_*
+    uint32_t id;
+    uint32_t mask;
+} WaitSpec;
+
+/*! Registration of a process on the wait list of an event source */
+typedef struct Waiter_S {
+    struct Waiter_S * next;            // Next registration on the wait list
+    struct Waiter_S ** list;           // Wait list of the source (or NULL if not on one)
+    struct Process_S * p;              // Waiting process
+    uint32_t mask;                     // Wake-up when any of these bits are signalled
+} Waiter;
+
+#ifdef BOARD_RPI2
+#define CACHE_LINE 64 // Cortex-A7 L1 data cache line, in bytes
+#else
+#define CACHE_LINE 32 // ARM1176 L1 data cache line, in bytes
+#endif
+
+/*! Cold part of a process: its stack, only touched by the process itself */
+typedef struct ProcessStack_S {
+    uint32_t magic;                    // STACK_MAGIC; the word below the stack, clobbered on overflow
+    uint32_t mem[STACK_SIZE];          // Process stack memory
+} ProcessStack;
 
+/*! Hot part of a process.
+ *
+ * The saved registers come first; start.S depends on this layout (see
+ * PROC_REGS_OFFSET). They are followed by the scheduling record: the fields
+ * read on every queue walk share a cache line (bytes 64..95 on ARM1176),
+ * and the struct is cache-line aligned so that no record straddles lines
+ * it doesn't need. Anything else that is only touched by the running
+ * process, by the console, or when the process blocks or is woken (the
+ * wait union), goes after it.
+ */
 typedef struct Process_S {
     uint32_t ps;                       // Saved Process Status
     uint32_t pc;                       // Saved Program Counter
     uint32_t registers[MAX_REGISTERS]; // Saved general registers
-    uint32_t pid;                      // Process identifier
-    uint32_t parent_pid;               // Parent process identifier
-    uint32_t flags;                    // Process flags
-    uint32_t sched_prio;               // Process scheduling priority
-    uint32_t exit_code;
-    uint32_t stack_magic;
-    uint32_t stack_mem[STACK_SIZE];    // Process stack memory. This is a hack
-                                       // but sufficient for now.
+    // Scheduling record
     uint32_t magic;
     struct Process_S * q_next;         // Next process in (some) queue (or NULL if process is running)
     union {
         uint32_t q_prio_uint32;        // Priority on (some) queue (32-bit)
         uint64_t q_prio_uint64;        // Priority on (some) queue (64-bit)
     };
-} Process;
+    uint32_t sched_prio;               // Process scheduling priority
+    uint32_t state;                    // Process state (PS_*)
+    uint32_t flags;                    // Process flags
+    uint32_t pid;                      // Process identifier
+    uint32_t cpu;                      // Core whose ready queue the process goes on
+    uint32_t affinity;                 // Core the process is pinned to (or CPU_ANY)
+    uint32_t wait_id;                  // Identifier of the object the process is blocked on
+    // Accounting
+    uint32_t parent_pid;               // Parent process identifier
+    uint32_t ticks;                    // Timer ticks charged to this process
+    uint32_t switches;                 // Number of times this process has been switched to
+    uint32_t exit_code;
+    PerfCount perf;                    // PMU counts while this process was running
+    PerfCount perf_children;           // PMU counts of reaped children (and their descendants)
+    Ring * ring;                       // Submission/completion rings (or NULL; see ring_setup)
+    uint32_t ring_flags;               // RING_* flags of the rings
+    // Blocked-operation state; only touched when the process blocks or is woken
+    union {
+        struct {
+            uint32_t mask;             // Event flags being waited for
+            uint32_t mode;             // Event wait mode (EVT_WAIT_*)
+        } evt;
+        struct {
+            uint32_t pid;              // Child process being waited for (or PID_ANY)
+            uint32_t * exit_code;      // Where to store the child's exit code (may be NULL)
+        } child;
+        struct {
+            uint8_t * buf;             // I/O buffer
+            uint32_t len;              // Length of the I/O buffer
+            uint32_t done;             // Number of bytes transferred so far
+        } io;
+        struct {
+            uint32_t mask;             // GPIO lines (bank 0) being waited for
+            uint32_t * timestamp;      // Where to store the event time (may be NULL)
+        } gpio;
+        struct {
+            WaitSpec src[WAIT_ANY_MAX];   // Event sources
+            Waiter reg[WAIT_ANY_MAX];     // Registrations, one per source
+            uint32_t count;               // Number of sources
+            uint32_t timeout;             // Index of the (earliest) timeout source
+        } any;
+    } wait;                            // State of the operation the process is blocked on
+    ProcessStack * stack;              // Stack of the process (cold)
+} __attribute__((aligned(CACHE_LINE))) Process;
+
+#define PROC_REGS_OFFSET 8 // Offset of registers[0] (also defined in start.S, which addresses the Process from sp_irq)
 
 #define PROC_MAGIC  2112
 #define STACK_MAGIC 0x42424242
 
 /*! Initialize */
 void p_init();
-/*! Create a new process */
+/*! Create a new process. Returns NULL if there are no free process slots */
 Process * p_create(const Process * parent, uint32_t entry_point, uint32_t init_param, uint32_t priority);
-/*! Insert the given process into the ready queue */
+/*! Pin a process to a core; it will only be queued on (and dispatched by) that core */
+void p_pin(Process * p, uint32_t cpu);
+/*! Insert the given process into the ready queue of its core */
 void p_ready(Process * insert);
-/*! Pop a process from the ready queue. Will panic if the queue is empty */
+/*! Pop a process from the ready queue of the calling core. Will panic if the queue is empty
+ *
+ * On SMP builds, a core that would otherwise go idle steals the first unpinned
+ * process it finds on another core's ready queue.
+ */
 Process * p_pop_ready();
-/*! Terminate the given process */
+#if SMP_CPUS>1
+/*! Returns the mask of cores that are running a process other than their idle process */
+uint32_t p_busy_cpus(void);
+#endif
+/*! Returns the first allocated process with a pid >= the given pid, or NULL */
+Process * p_next(uint32_t pid);
+/*! Terminate the given process.
+ *
+ * The process becomes a zombie until it is reaped by its parent; processes
+ * without a parent are reaped immediately. Children of the terminated process
+ * are reparented (they no longer have a parent.)
+ */
 void p_terminate(Process * p, uint32_t exit_code);
 
+// Wait options
+#define WAIT_NOHANG 0b00000001  // Don't block if no child has terminated
+
+// Wait results (otherwise the pid of the reaped child)
+#define W_NO_CHILD ((uint32_t)(-1)) // No matching child process
+#define W_RUNNING  ((uint32_t)(-2)) // Matching children are still running (WAIT_NOHANG)
+#define W_BLOCKED  ((uint32_t)(-3)) // Process is blocked, waiting for a child to terminate
+
+/*! Reap a terminated child process (pid, or PID_ANY for any child).
+ *
+ * The PMU counts of the reaped child are added to the parent's perf_children.
+ */
+uint32_t p_wait(Process * p, uint32_t pid, uint32_t * exit_code, uint32_t options);
+
+// p_wait_any results (otherwise the index of the ready source)
+#define WAIT_ANY_ILLEGAL ((uint32_t)(-1)) // Invalid event source
+#define WAIT_ANY_BLOCKED ((uint32_t)(-3)) // Process is blocked, waiting for a source
+
+/*! Wait for the first of several event sources to become ready (see sys_wait_any).
+ *
+ * Returns the index of the first source that is ready now. Otherwise the
+ * process is registered on the wait list of each source (the timeout goes on
+ * the sleep queue), and it resumes with the index of the source that woke it
+ * in R0. Being woken doesn't consume anything; the process then makes the
+ * call for that source (sys_read, sys_wait, ...), which won't block unless
+ * another process got there first.
+ */
+uint32_t p_wait_any(Process * p, const WaitSpec * sources, uint32_t count, uint64_t now);
+
 /*! Put the given process to sleep for some time */
 void p_sleep(Process * running, uint64_t sleep_until);
 /*! Move processes from the sleep queue to the ready queue  */
@@ -65,6 +241,7 @@ typedef struct Monitor_S {
     struct Queue_S entry_q;     // Entrance queue; processes waiting to enter monitor
     struct Queue_S cond_q;      // Condition queue; processes waiting for notification
     struct Process_S * p;       // Process currently occupying the monitor
+    struct Waiter_S * any_q;    // p_wait_any registrations
     uint32_t mid;               // Monitor identifier
     uint32_t flags;             // Monitor flags (see above)
 } Monitor;
@@ -82,4 +259,120 @@ int m_exit(Process * p, uint32_t mid);
 int m_wait(Process * p, uint32_t mid);
 int m_notify(Process * p, uint32_t mid);
 
+// Semaphore flags
+#define S_ALLOCATED 0b00000001  // Semaphore is in use
+
+typedef struct Semaphore_S {
+    struct Queue_S wait_q;      // Processes waiting for the semaphore
+    struct Waiter_S * any_q;    // p_wait_any registrations
+    uint32_t count;             // Semaphore count
+    uint32_t sid;               // Semaphore identifier
+    uint32_t flags;             // Semaphore flags (see above)
+} Semaphore;
+
+#define SID_NONE ((uint32_t)(-1))
+
+// Semaphore operations return the same result codes as monitor operations (M_*)
+uint32_t sem_create(uint32_t count);
+int sem_wait(Process * p, uint32_t sid);
+int sem_signal(uint32_t sid);
+
+// Event flag group flags
+#define E_ALLOCATED 0b00000001  // Event flag group is in use
+
+// Event wait modes
+#define EVT_WAIT_ANY 0b00000000 // Wait for any of the flags in the mask
+#define EVT_WAIT_ALL 0b00000001 // Wait for all of the flags in the mask
+#define EVT_CONSUME  0b00000010 // Clear the matched flags when the wait is satisfied
+
+typedef struct EventFlags_S {
+    struct Queue_S wait_q;      // Processes waiting for flags to be set
+    struct Waiter_S * any_q;    // p_wait_any registrations
+    uint32_t events;            // Current value of the 32 event flags
+    uint32_t eid;               // Event flag group identifier
+    uint32_t flags;             // Event flag group flags (see above)
+} EventFlags;
+
+#define EID_NONE ((uint32_t)(-1))
+
+uint32_t evt_create();
+/*! Wait for flags. Returns the matched flags, or 0 if the process was blocked */
+uint32_t evt_wait(Process * p, uint32_t eid, uint32_t mask, uint32_t mode);
+int evt_set(uint32_t eid, uint32_t mask);
+int evt_clear(uint32_t eid, uint32_t mask);
+
+// Timer flags
+#define T_ALLOCATED 0b00000001  // Timer is in use
+
+/*! Periodic timer, on the system timer clock */
+typedef struct Timer_S {
+    uint64_t expiry;            // Start of the next period (system timer, microseconds)
+    uint32_t period;            // Period, in microseconds
+    uint32_t tid;               // Timer identifier
+    uint32_t flags;             // Timer flags (see above)
+} Timer;
+
+#define TID_NONE ((uint32_t)(-1))
+
+// Timer results
+#define T_ILLEGAL_ARG ((uint32_t)(-1)) // No such timer
+#define T_BLOCKED     ((uint32_t)(-3)) // Process is sleeping until the next period starts
+
+/*! Create a periodic timer; its first period ends period_us after now */
+uint32_t tmr_create(uint32_t period_us, uint64_t now);
+/*! Wait for the start of the next period.
+ *
+ * Periods are counted from the creation of the timer, not from the wait, so
+ * time spent between waits doesn't add up. If the period has already
+ * started, returns the number of (later) period starts that were missed,
+ * and continues from the latest one. Otherwise the process sleeps until
+ * the period starts (T_BLOCKED), and resumes without overruns.
+ */
+uint32_t tmr_wait(Process * p, uint32_t tid, uint64_t now);
+
+// Submission/completion rings (see ring.h)
+
+/*! Register the rings of a process (NULL to unregister), with RING_* flags. Resets the rings */
+void ring_setup(Process * p, Ring * ring, uint32_t flags);
+/*! Process the posted operations of a process, in order, posting a completion for each.
+ *
+ * Stops early when the completion ring is full. Returns the number of
+ * operations processed.
+ */
+uint32_t ring_enter(Process * p);
+/*! Process the posted operations of every RING_POLL ring (called when a core is idle).
+ *
+ * RING_OP_MON_NOTIFY is left for ring_enter, since the process may not be
+ * in the monitor while it isn't running. Returns the number of operations
+ * processed.
+ */
+uint32_t ring_poll(void);
+
+// I/O result when the process is blocked (otherwise the number of bytes transferred)
+#define IO_BLOCKED ((uint32_t)(-1))
+
+/*! Read from the console UART. Blocks until at least one byte is available */
+uint32_t io_read(Process * p, uint8_t * buf, uint32_t len);
+/*! Write to the console UART. Blocks until all bytes have been buffered */
+uint32_t io_write(Process * p, const uint8_t * buf, uint32_t len);
+/*! Move processes waiting for input to the ready queue, once data is available */
+void io_rx_ready();
+/*! Continue processes waiting for output, once buffer space is available */
+void io_tx_ready();
+
+/*! Select the events detected on a GPIO line in bank 0 (0 disables detection).
+ *
+ * Events on the line less than debounce_us microseconds after the last
+ * accepted event are ignored. Returns 0, or non-zero for an invalid line.
+ */
+uint32_t gpio_configure(uint32_t gpio, uint32_t events, uint32_t debounce_us);
+/*! Wait for events on the GPIO lines in mask, until the deadline (system timer; 0 for none).
+ *
+ * Returns the lines with (not yet delivered) events, or 0 if the process was
+ * blocked. A blocked process resumes with the lines in R0, or 0 on timeout.
+ */
+uint32_t gpio_wait(Process * p, uint32_t mask, uint64_t deadline, uint32_t * timestamp);
+/*! Deliver GPIO events detected at the given time (system timer, microseconds) */
+void gpio_events(uint32_t events, uint32_t now_us);
+
 #endif // __PROCTL_H__
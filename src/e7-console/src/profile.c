@@ -0,0 +1,70 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* profile.c
+ *
+ * (pid, pc) sample histogram; an open-addressed hash table. Only updated
+ * in IRQ-mode, and only read in Supervisor-mode (interrupts disabled.)
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "profile.h"
+
+static struct {
+    uint32_t period;    // Sample every period ticks (0 when stopped)
+    uint32_t countdown; // Ticks until the next sample
+    ProfEntry other;    // Samples that didn't fit in the table
+    ProfEntry entries[PROF_ENTRIES];
+} prof;
+
+void prof_start(uint32_t period) {
+    for(int i=0; i<PROF_ENTRIES; i++) {
+        prof.entries[i].count = 0;
+    }
+    prof.other.pc = PROF_OTHER_PC;
+    prof.other.pid = 0;
+    prof.other.count = 0;
+    prof.period = period;
+    prof.countdown = period;
+}
+
+void prof_stop(void) {
+    prof.period = 0;
+}
+
+static inline uint32_t prof_hash(uint32_t pid, uint32_t pc) {
+    // Fibonacci hashing of the instruction address (word aligned), mixed with the pid
+    return (((pc>>2) ^ (pid<<24)) * 2654435761U) >> 23;
+}
+
+void prof_tick(uint32_t pid, uint32_t pc) {
+    if(!prof.period || --prof.countdown) {
+        return;
+    }
+    prof.countdown = prof.period;
+    uint32_t h = prof_hash(pid,pc);
+    for(int i=0; i<PROF_PROBES; i++) {
+        ProfEntry * e = &prof.entries[(h+i) & (PROF_ENTRIES-1)];
+        if(e->count==0) {
+            e->pc = pc;
+            e->pid = pid;
+            e->count = 1;
+            return;
+        }
+        if(e->pc==pc && e->pid==pid) {
+            e->count++;
+            return;
+        }
+    }
+    prof.other.count++;
+}
+
+const ProfEntry * prof_next(uint32_t * index) {
+    for(; *index<PROF_ENTRIES; (*index)++) {
+        if(prof.entries[*index].count) {
+            return &prof.entries[*index];
+        }
+    }
+    if(*index==PROF_ENTRIES && prof.other.count) {
+        return &prof.other;
+    }
+    return NULL;
+}
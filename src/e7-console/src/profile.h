@@ -0,0 +1,31 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+/* profile.h
+ *
+ * Statistical sampling profiler. On every Nth timer tick, the pc of the
+ * interrupted process is counted in a (pid, pc) histogram. Use
+ * tools/prof2sym.py to symbolize a dump of the histogram against kernel.elf.
+ */
+#include <stdint.h>
+
+#define PROF_ENTRIES 512    // Histogram entries; must be a power of 2
+#define PROF_PROBES  8      // Max entries searched for a free slot
+#define PROF_OTHER_PC 0     // pc of the entry that counts samples that didn't fit
+
+typedef struct ProfEntry_S {
+    uint32_t pc;        // Sampled program counter
+    uint32_t pid;       // Sampled process
+    uint32_t count;     // Number of samples (0 if the entry is unused)
+} ProfEntry;
+
+/*! Clear the histogram, and start sampling every period timer ticks */
+void prof_start(uint32_t period);
+/*! Stop sampling */
+void prof_stop(void);
+/*! Called on every timer tick, with the interrupted process */
+void prof_tick(uint32_t pid, uint32_t pc);
+/*! Returns the first used entry at or after *index (and updates *index), or NULL */
+const ProfEntry * prof_next(uint32_t * index);
+
+#endif // __PROFILE_H__
@@ -0,0 +1,89 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* ring.h
+ *
+ * Submission/completion rings (see sys_ring_enter); the layout shared by
+ * a process (toast.h) and the kernel (proctl.h).
+ */
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "arm.h"
+
+#define RING_ENTRIES 16 // Entries in each ring (a power of two)
+
+#define RING_POLL 0b00000001 // Ring is also drained when a core is idle (see sys_ring_setup)
+
+// Ring operations; the result is what the equivalent system call returns
+#define RING_OP_NOP             0 // No operation
+#define RING_OP_SET_LED         1 // arg[0] = LED, arg[1] = value
+#define RING_OP_GPIO_WRITE_MASK 2 // arg[0] = bank, arg[1] = set mask, arg[2] = clear mask
+#define RING_OP_LOG             3 // arg[0] = string, valid until the operation completes
+#define RING_OP_EVT_SET         4 // arg[0] = eid, arg[1] = flags
+#define RING_OP_SEM_SIGNAL      5 // arg[0] = sid
+#define RING_OP_MON_NOTIFY      6 // arg[0] = mid; the process must be in the monitor
+
+#define RING_ILLEGAL_OP ((uint32_t)(-1)) // Completion result of an unknown operation
+
+/*! An operation posted by the process */
+typedef struct RingSubmit_S {
+    uint32_t op;        // RING_OP_*
+    uint32_t arg[3];
+    uint32_t user_data; // Copied to the completion
+} RingSubmit;
+
+/*! Result of an operation, posted by the kernel */
+typedef struct RingComplete_S {
+    uint32_t user_data;
+    uint32_t res;       // Result of the operation
+} RingComplete;
+
+/*! Submission and completion rings, in the memory of the process.
+ *
+ * The heads and tails are free-running counters; the entry is the counter
+ * modulo RING_ENTRIES. Each counter has a single writer: the process owns
+ * sq_tail and cq_head (use ring_submit and ring_complete), the kernel
+ * sq_head and cq_tail.
+ */
+typedef struct Ring_S {
+    volatile uint32_t sq_head;  // Next submission to process
+    volatile uint32_t sq_tail;  // Next free submission entry
+    volatile uint32_t cq_head;  // Next completion to take
+    volatile uint32_t cq_tail;  // Next free completion entry
+    RingSubmit sq[RING_ENTRIES];
+    RingComplete cq[RING_ENTRIES];
+} Ring;
+
+/*! Post an operation to the submission ring. Returns false if it is full */
+static inline bool ring_submit(Ring * ring, uint32_t op, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t user_data) {
+    uint32_t tail = ring->sq_tail;
+    if(tail - ring->sq_head >= RING_ENTRIES) {
+        return false;
+    }
+    MEMORY_BARRIER(); // The kernel is done with the entry before we overwrite it
+    RingSubmit * sqe = &ring->sq[tail & (RING_ENTRIES-1)];
+    sqe->op = op;
+    sqe->arg[0] = a0;
+    sqe->arg[1] = a1;
+    sqe->arg[2] = a2;
+    sqe->user_data = user_data;
+    MEMORY_BARRIER(); // Write the entry before the tail that publishes it
+    ring->sq_tail = tail + 1;
+    return true;
+}
+
+/*! Take the next completion from the completion ring. Returns false if there is none */
+static inline bool ring_complete(Ring * ring, RingComplete * c) {
+    uint32_t head = ring->cq_head;
+    if(head==ring->cq_tail) {
+        return false;
+    }
+    MEMORY_BARRIER(); // Read the entry after the tail that published it
+    *c = ring->cq[head & (RING_ENTRIES-1)];
+    MEMORY_BARRIER(); // Done with the entry before it is handed back
+    ring->cq_head = head + 1;
+    return true;
+}
+
+#endif // __RING_H__
@@ -33,3 +33,11 @@ char * itoa(int val, char* buff, int base)  {
     *pch = 0;
     return reverse(buff,pch-buff); 
 } 
+
+uint32_t str_len(const char * str) {
+    const char * pch = str;
+    while(*pch) {
+        pch++;
+    }
+    return pch-str;
+}
@@ -1,8 +1,12 @@
 // Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
 #ifndef __STR_H__
 #define __STR_H__
+#include <stdint.h>
 
 /*! Convert the given integer value to a string of the given base */
 char * itoa(int val, char * buff, int base);
 
+/*! Length of the given string */
+uint32_t str_len(const char * str);
+
 #endif // __STR_H__
@@ -12,13 +12,29 @@
 #include "swi-ops.h"
 #include "str.h"
 #include "assert.h"
+#include "klog.h"
+#include "trace.h"
+#include "profile.h"
+#include "swistat.h"
+#include "perf.h"
+#include "boot.h"
+#include "kprintf.h"
 
 #define NOINLINE __attribute__((noinline))
 
 void idle_proc(uint32_t init_param);
+#if SMP_CPUS>1
+extern void secondary_start(void);
+#endif
 void root_proc(uint32_t init_param);
+void klog_proc(uint32_t eid);
 
-extern uint32_t app_main(uint32_t init_param);
+// The application process; e.g. build with APP=bench to run bench_main instead
+#ifndef APP_MAIN
+#define APP_MAIN app_main
+#endif
+extern uint32_t APP_MAIN(uint32_t init_param);
+extern void console_main(void);
 
 /*! A little LED animation
  *
@@ -26,27 +42,23 @@ extern uint32_t app_main(uint32_t init_param);
  *
  */
 NOINLINE void animate_leds(int iters) {
+    // Set and clear all the LEDs (in GPIO bank 0) with one register write each per frame
+    static const uint32_t leds[4] = {
+        GPIO_BIT(SYS_LED_BLUE), GPIO_BIT(SYS_LED_RED), GPIO_BIT(SYS_LED_YELLOW), GPIO_BIT(SYS_LED_GREEN)
+    };
+    const uint32_t all = leds[0] | leds[1] | leds[2] | leds[3];
     while(iters--) {
         for(int i=0; i<4; i++) {
-            gpio_write(SYS_LED_BLUE,i==0);
-            gpio_write(SYS_LED_RED,i==1);
-            gpio_write(SYS_LED_YELLOW,i==2);
-            gpio_write(SYS_LED_GREEN,i==3);
+            gpio_write_mask(GPIO_BANK(SYS_LED_BLUE),leds[i],all & ~leds[i]);
             busy_wait_millis(50);
         }
         for(int i=3; i>=0; i--) {
-            gpio_write(SYS_LED_BLUE,i==0);
-            gpio_write(SYS_LED_RED,i==1);
-            gpio_write(SYS_LED_YELLOW,i==2);
-            gpio_write(SYS_LED_GREEN,i==3);
+            gpio_write_mask(GPIO_BANK(SYS_LED_BLUE),leds[i],all & ~leds[i]);
             busy_wait_millis(50);
         }
     }
     // Clear LEDs
-    gpio_write(SYS_LED_BLUE,0);
-    gpio_write(SYS_LED_RED,0);
-    gpio_write(SYS_LED_YELLOW,0);
-    gpio_write(SYS_LED_GREEN,0);
+    gpio_write_mask(GPIO_BANK(SYS_LED_BLUE),0,all);
     busy_wait_millis(1000);
 }
 
@@ -64,16 +76,31 @@ Process * s_init(void) {
     gpio_set_func(SYS_LED_YELLOW,GPF_OUTPUT); 
     gpio_set_func(SYS_LED_GREEN,GPF_OUTPUT);
     
+#ifndef FAST_BOOT
     animate_leds(3);
+#endif
 
-    uart_init(BAUD_115200);
+    cycle_counter_init();
+    uart_init(CONSOLE_BAUD);
     uart_puts("\033c"); // clear screen
     uart_puts("\033[32;1mTOAST\033[0m is starting up\r\n");
 
     p_init();
+    boot_mark(BOOT_P_INIT);
+    perf_select(PERF_EVT_ICACHE_MISS,PERF_EVT_DCACHE_MISS);
+    uint32_t klog_eid = klog_init();
 
-    p_ready(p_create(NULL,(uint32_t)root_proc,0,0));   // root process
-    p_ready(p_create(NULL,(uint32_t)idle_proc,0,255)); // idle process
+    p_ready(p_create(NULL,(uint32_t)root_proc,0,0));          // root process
+    p_ready(p_create(NULL,(uint32_t)klog_proc,klog_eid,254)); // log process
+    for(uint32_t cpu=0; cpu<SMP_CPUS; cpu++) {
+        Process * idle = p_create(NULL,(uint32_t)idle_proc,cpu,255); // idle process of each core
+        idle->flags |= P_IDLE;
+        p_pin(idle,cpu);
+        p_ready(idle);
+    }
+
+    // GPIO event interrupts (see gpio_configure)
+    irq_registers->enable_irqs_2 = IRQ_2_GPIO;
 
     // Enable timer and timer interrupts for time slicing.
 
@@ -90,23 +117,87 @@ Process * s_init(void) {
         timer_registers->load = quantum;
     }
 
-    uart_puts("Dispatching root process\r\n");
+#if SMP_CPUS>1
+    // Peripheral interrupts go to this core; the others are interrupted by it (see s_schedule)
+    ipi_init();
+    smp_start(secondary_start);
+#endif
+
+    klog(KLOG_INFO,PID_NONE,"dispatching root process");
 
+    boot_mark(BOOT_DISPATCH);
+    boot_report(); // Logged, so it doesn't hold up the first dispatch
     return p_pop_ready();
 }
 
+#if SMP_CPUS>1
+/*! Invoked on each secondary core, after s_init has started it (with the kernel lock held)
+ *
+ * Returns a pointer to the first Process to be dispatched on the core.
+ */
+Process * s_init_cpu(void) {
+    ipi_init();
+    KLogRecord * r = klog_begin(KLOG_INFO,PID_NONE);
+    klog_str(r,"started core ");
+    klog_num(r,cpu_id(),10);
+    klog_commit(r);
+    return p_pop_ready();
+}
+#endif
+
+/*! Account for a switch from the running process to the next process */
+static inline void s_switch(Process * running, Process * next) {
+    if(next!=running) {
+        // Check the stack canary here, rather than on every trap; it costs a dependent load
+        ASSERT(running->stack->magic==STACK_MAGIC,FC_STACK_OVERFLOW)
+        TRACE(TR_SWITCH,running->pid,next->pid)
+        perf_charge(running);
+        next->switches++;
+    }
+}
+
 /*! Process scheduler
  *
 */
 Process * s_schedule(Process * running) {
     ASSERT(running!=NULL,FC_NO_PROCESS)
     ASSERT(running->magic==PROC_MAGIC,FC_INVALID_PROC_MAGIC)
-    ASSERT(running->stack_magic==STACK_MAGIC,FC_STACK_OVERFLOW)
+    TRACE(TR_IRQ,running->pid,irq_registers->irq_basic_pending)
     p_rouse(system_timer());
-    if(timer_registers->masked_irq) {
+    bool tick = false;
+    // Peripheral interrupts are only routed to core 0
+    if(cpu_id()==0 && gpio_irq_pending()) {
+        // Timestamp the events as early as possible
+        uint32_t now_us = (uint32_t)system_timer();
+        gpio_events(gpio_irq(),now_us);
+    }
+    if(cpu_id()==0 && uart_irq_pending()) {
+        uint32_t events = uart_irq();
+        if(events & UART_RX) {
+            io_rx_ready();
+        }
+        if(events & UART_TX) {
+            io_tx_ready();
+        }
+    }
+#if SMP_CPUS>1
+    // Another core has made a process ready for this one, or is passing on its tick
+    if(ipi_irq()) {
+        tick = true;
+    }
+#endif
+    if(cpu_id()==0 && timer_registers->masked_irq) {
         timer_registers->irq_ack = IRQ_TIMER;
-        p_ready(running);
-        running = p_pop_ready();
+        tick = true;
+#if SMP_CPUS>1
+        // Time-slice the other busy cores, too
+        uint32_t busy = p_busy_cpus();
+        for(uint32_t cpu=1; cpu<SMP_CPUS; cpu++) {
+            if(busy & (1<<cpu)) {
+                ipi_send(cpu);
+            }
+        }
+#endif
 
         // Pulsing LED
         #define DELAY 50
@@ -129,125 +220,404 @@ Process * s_schedule(Process * running) {
             }
         }
     }
+    if(tick) {
+        if(running->flags & P_IDLE) {
+            // Nothing else to run; process operations posted to polled rings
+            ring_poll();
+        }
+        running->ticks++;
+        prof_tick(running->pid,running->pc);
+        p_ready(running);
+        Process * next = p_pop_ready();
+        s_switch(running,next);
+        running = next;
+    }
     return running;
 }
 
-/*! System-call router
- *
- */
-Process * s_sys_router(Process * running, int swi_num, uint32_t * args) {
+/*! Create and ready a child process, with FORK_CPU options in priority. Returns NULL if out of slots */
+static Process * s_fork(Process * running, uint32_t entry_point, uint32_t init_param, uint32_t priority) {
+    uint32_t cpu = (priority >> 8) - 1; // FORK_CPU(cpu), or CPU_ANY
+    if(cpu!=CPU_ANY && cpu>=SMP_CPUS) {
+        return NULL;
+    }
+    Process * p = p_create(running,entry_point,init_param,priority & FORK_PRIO_MASK);
+    if(p) {
+        if(cpu!=CPU_ANY) {
+            p_pin(p,cpu);
+        }
+        p_ready(p);
+    }
+    return p;
+}
+
+// System-call handlers, one for each SYSCALL in syscalls.def. The arguments
+// are in args[0..2], and the result goes in args[0] (R0 of the caller).
+// Returns the process to dispatch, or NULL to return to the caller.
+typedef Process * (*SwiHandler)(Process * running, uint32_t * args);
+
+static Process * swi_set_led(Process * running, uint32_t * args) {
+    gpio_write(args[0],args[1]);
+    return NULL;
+}
+
+static Process * swi_clock_millis(Process * running, uint32_t * args) {
+    args[0] = udiv1000_u64(system_timer());
+    return NULL;
+}
+
+static Process * swi_fork(Process * running, uint32_t * args) {
+    Process * p = s_fork(running,args[0],args[1],args[2]);
+    // Return the new pid to the calling process
+    args[0] = p ? p->pid : PID_NONE;
+    return NULL;
+}
+
+static Process * swi_mon_create(Process * running, uint32_t * args) {
+    args[0] = m_create();
+    return NULL;
+}
+
+static Process * swi_mon_exit(Process * running, uint32_t * args) {
+    args[0] = m_exit(running,args[0]);
+    return NULL;
+}
+
+static Process * swi_mon_notify(Process * running, uint32_t * args) {
+    args[0] = m_notify(running,args[0]);
+    return NULL;
+}
+
+static Process * swi_get_pid(Process * running, uint32_t * args) {
+    args[0] = running->pid;
+    return NULL;
+}
+
+static Process * swi_sem_create(Process * running, uint32_t * args) {
+    args[0] = sem_create(args[0]);
+    return NULL;
+}
+
+static Process * swi_sem_signal(Process * running, uint32_t * args) {
+    args[0] = sem_signal(args[0]);
+    return NULL;
+}
+
+static Process * swi_evt_create(Process * running, uint32_t * args) {
+    args[0] = evt_create();
+    return NULL;
+}
+
+static Process * swi_evt_set(Process * running, uint32_t * args) {
+    args[0] = evt_set(args[0],args[1]);
+    return NULL;
+}
+
+static Process * swi_evt_clear(Process * running, uint32_t * args) {
+    args[0] = evt_clear(args[0],args[1]);
+    return NULL;
+}
+
+static Process * swi_log(Process * running, uint32_t * args) {
+    klog(KLOG_INFO,running->pid,(const char *)args[0]);
+    return NULL;
+}
+
+static Process * swi_proc_info(Process * running, uint32_t * args) {
+    Process * p = p_next(args[0]);
+    if(p) {
+        ProcInfo * info = (ProcInfo *)args[1];
+        info->pid = p->pid;
+        info->parent_pid = p->parent_pid;
+        info->priority = p->sched_prio;
+        info->state = p->state;
+        info->wait_id = p->wait_id;
+        info->ticks = p->ticks;
+        info->switches = p->switches;
+        args[0] = p->pid;
+    } else {
+        args[0] = PID_NONE;
+    }
+    return NULL;
+}
+
+static Process * swi_cycles(Process * running, uint32_t * args) {
+    args[0] = cycle_counter();
+    return NULL;
+}
+
+static Process * swi_prof_ctl(Process * running, uint32_t * args) {
+    if(args[0]) {
+        prof_start(args[0]);
+    } else {
+        prof_stop();
+    }
+    return NULL;
+}
+
+static Process * swi_prof_read(Process * running, uint32_t * args) {
+    uint32_t index = args[0];
+    const ProfEntry * e = prof_next(&index);
+    if(e) {
+        ProfSample * sample = (ProfSample *)args[1];
+        sample->pid = e->pid;
+        sample->pc = e->pc;
+        sample->count = e->count;
+        args[0] = index;
+    } else {
+        args[0] = PROF_NONE;
+    }
+    return NULL;
+}
+
+static Process * swi_swi_stat(Process * running, uint32_t * args) {
+    uint32_t swi = args[0];
+    SwiStat * stat = (SwiStat *)args[1];
+    const LatHist * h;
+    if(stat==NULL) {
+        swistat_clear();
+        args[0] = SWI_NONE;
+    } else if((h = swistat_next(&swi))) {
+        stat->swi = swi;
+        stat->count = h->count;
+        stat->p50 = lat_percentile(h,50);
+        stat->p99 = lat_percentile(h,99);
+        stat->max = h->max;
+        args[0] = swi;
+    } else {
+        args[0] = SWI_NONE;
+    }
+    return NULL;
+}
+
+static Process * swi_perf_ctl(Process * running, uint32_t * args) {
+    perf_select(args[0],args[1]);
+    return NULL;
+}
+
+static Process * swi_perf_read(Process * running, uint32_t * args) {
+    Process * p = p_next(args[0]);
+    if(p && p->pid==args[0]) {
+        perf_charge(running);
+        const PerfCount * c = args[1]==PERF_CHILDREN ? &p->perf_children : &p->perf;
+        PerfStat * stat = (PerfStat *)args[2];
+        stat->cycles = c->cycles;
+        for(int i=0; i<PERF_EVENTS; i++) {
+            stat->events[i] = c->events[i];
+            stat->types[i] = perf_event(i);
+        }
+    } else {
+        args[0] = PID_NONE;
+    }
+    return NULL;
+}
+
+static Process * swi_gpio_write_mask(Process * running, uint32_t * args) {
+    args[0] = gpio_write_mask(args[0],args[1],args[2]);
+    return NULL;
+}
+
+static Process * swi_gpio_read_bank(Process * running, uint32_t * args) {
+    args[0] = gpio_read_bank(args[0]);
+    return NULL;
+}
+
+static Process * swi_gpio_irq(Process * running, uint32_t * args) {
+    args[0] = gpio_configure(args[0],args[1],args[2]);
+    return NULL;
+}
+
+static Process * swi_spawn_batch(Process * running, uint32_t * args) {
+    // Worker i gets init_param i; returns the number of workers created
+    uint32_t n = 0;
+    while(n<args[1] && s_fork(running,args[0],n,args[2])) {
+        n++;
+    }
+    args[0] = n;
+    return NULL;
+}
+
+static Process * swi_timer_create(Process * running, uint32_t * args) {
+    args[0] = tmr_create(args[0],system_timer());
+    return NULL;
+}
+
+static Process * swi_ring_setup(Process * running, uint32_t * args) {
+    ring_setup(running,(Ring *)args[0],args[1]);
+    args[0] = 0;
+    return NULL;
+}
+
+static Process * swi_ring_enter(Process * running, uint32_t * args) {
+    args[0] = ring_enter(running);
+    return NULL;
+}
+
+static Process * swi_entry_baseline(Process * running, uint32_t * args) {
+    swi_entry_select(args[0]!=0);
+    return NULL;
+}
+
+// (Potentially) blocking SWIs
+
+static Process * swi_exit(Process * running, uint32_t * args) {
+    perf_charge(running); // before the counts are passed on to the parent
+    p_terminate(running,args[0]);
+    return p_pop_ready();
+}
+
+static Process * swi_yield(Process * running, uint32_t * args) {
+    p_ready(running);
+    return p_pop_ready();
+}
+
+static Process * swi_sleep_millis(Process * running, uint32_t * args) {
+    p_sleep(running, system_timer() + ((uint64_t)1000 * args[0]));
+    return p_pop_ready();
+}
+
+static Process * swi_sleep_until(Process * running, uint32_t * args) {
+    uint64_t deadline = ((uint64_t)args[1] << 32) | args[0];
+    if(deadline<=system_timer()) {
+        return NULL;
+    }
+    p_sleep(running,deadline);
+    return p_pop_ready();
+}
+
+static Process * swi_timer_wait(Process * running, uint32_t * args) {
+    args[0] = tmr_wait(running,args[0],system_timer());
+    if(args[0]!=T_BLOCKED) {
+        return NULL;
+    }
+    args[0] = 0; // on time
+    return p_pop_ready();
+}
+
+static Process * swi_mon_enter(Process * running, uint32_t * args) {
+    args[0] = m_enter(running,args[0]);
+    return args[0]==M_BLOCKED ? p_pop_ready() : NULL;
+}
+
+static Process * swi_mon_wait(Process * running, uint32_t * args) {
+    args[0] = m_wait(running,args[0]);
+    return args[0]==M_BLOCKED ? p_pop_ready() : NULL;
+}
+
+static Process * swi_sem_wait(Process * running, uint32_t * args) {
+    args[0] = sem_wait(running,args[0]);
+    return args[0]==M_BLOCKED ? p_pop_ready() : NULL;
+}
+
+static Process * swi_evt_wait(Process * running, uint32_t * args) {
+    args[0] = evt_wait(running,args[0],args[1],args[2]);
+    return args[0]==0 ? p_pop_ready() : NULL;
+}
+
+static Process * swi_wait(Process * running, uint32_t * args) {
+    args[0] = p_wait(running,args[0],(uint32_t *)args[1],args[2]);
+    return args[0]==W_BLOCKED ? p_pop_ready() : NULL;
+}
+
+static Process * swi_gpio_wait(Process * running, uint32_t * args) {
+    uint64_t deadline = args[1] ? system_timer() + ((uint64_t)1000 * args[1]) : 0;
+    args[0] = gpio_wait(running,args[0],deadline,(uint32_t *)args[2]);
+    return args[0]==0 ? p_pop_ready() : NULL;
+}
+
+static Process * swi_wait_any(Process * running, uint32_t * args) {
+    args[0] = p_wait_any(running,(const WaitSpec *)args[0],args[1],system_timer());
+    return args[0]==WAIT_ANY_BLOCKED ? p_pop_ready() : NULL;
+}
+
+static Process * swi_read(Process * running, uint32_t * args) {
+    args[0] = io_read(running,(uint8_t *)args[0],args[1]);
+    return args[0]==IO_BLOCKED ? p_pop_ready() : NULL;
+}
+
+static Process * swi_write(Process * running, uint32_t * args) {
+    args[0] = io_write(running,(const uint8_t *)args[0],args[1]);
+    return args[0]==IO_BLOCKED ? p_pop_ready() : NULL;
+}
+
+// Dispatch table, indexed by [blocking][SWI number within the range]
+static const SwiHandler swi_table[2][SWI_SLOTS] = {
+#define SYSCALL(num,NAME,name,stub) [((num) & SWI_BLOCKING) ? 1 : 0][(num) & ~SWI_BLOCKING] = swi_##name,
+#include "syscalls.def"
+#undef SYSCALL
+};
+
+/*! Run the handler of a system call (NULL if the SWI is invalid) */
+static inline Process * s_sys_route(Process * running, int swi_num, uint32_t * args, SwiHandler handler) {
     ASSERT(running!=NULL,FC_NO_PROCESS)
     ASSERT(running->magic==PROC_MAGIC,FC_INVALID_PROC_MAGIC)
-    ASSERT(running->stack_magic==STACK_MAGIC,FC_STACK_OVERFLOW)
+    TRACE(TR_SWI_ENTER,running->pid,swi_num)
     Process * dispatch = NULL;
-    switch(swi_num) {
-    default:
+    if(handler) {
+        dispatch = handler(running,args);
+    } else {
         // invalid
-        uart_puts("WARNING: Invalid SWI: ");
-        uart_putn(swi_num);
-        uart_puts("\n");
-        break;
-    case SWI_GET_PID:
-        args[0] = running->pid;
-        break;        
-    case SWI_SET_LED:
-        gpio_write(args[0],args[1]);
-        break;
-    case SWI_CLOCK_MILLIS:
-        args[0] = system_timer()/1000;
-        break;
-    case SWI_FORK: {
-        Process * p = p_create(
-            running,
-            args[0],
-            args[1],
-            args[2]);
-        p_ready(p);
-        // Return the new pid to the calling process
-        running->registers[0] = p->pid;
-        break;
-        }
-    case SWI_MON_CREATE:
-        args[0] = m_create();
-        break;
-    case SWI_MON_EXIT:
-        args[0] = m_exit(running,args[0]);
-        break;
-    case SWI_MON_NOTIFY:
-        args[0] = m_notify(running,args[0]);
-        break;
-    // (Potentially) blocking SWIs
-    case SWI_EXIT:
-        p_terminate(running,args[0]);
-        dispatch = p_pop_ready();
-        break;
-    case SWI_YIELD:
-        p_ready(running);
-        dispatch = p_pop_ready();
-        break;
-    case SWI_SLEEP_MILLIS:
-        p_sleep(running, system_timer() + ((uint64_t)1000 * args[0]));
-        dispatch = p_pop_ready();
-        break;
-    case SWI_MON_ENTER:
-        args[0] = m_enter(running,args[0]);
-        if(args[0]==M_BLOCKED) {
-            dispatch = p_pop_ready();
-        }
-        break;
-    case SWI_MON_WAIT:
-        args[0] = m_wait(running,args[0]);
-        if(args[0]==M_BLOCKED) {
-            dispatch = p_pop_ready();
-        }
-        break;
-    case SWI_LOG: {
-        char buff[8];
-        uart_puts("\033[33;1m");
-        uart_puts("pid=");
-        uart_puts(itoa(running->pid,buff,10));
-        uart_puts(": ");
-        uart_puts("\033[0m");
-        uart_puts((const char *)args[0]);
-        uart_puts("\r\n");
-        }
-        break;
+        KLogRecord * r = klog_begin(KLOG_WARN,running->pid);
+        klog_str(r,"invalid SWI: ");
+        klog_num(r,swi_num,16);
+        klog_commit(r);
+    }
+    TRACE(TR_SWI_EXIT,running->pid,swi_num)
+    swistat_record(swi_num,cycle_counter()-swi_entry_cycles);
+    if(dispatch) {
+        s_switch(running,dispatch);
     }
     return dispatch;
 }
 
-// Low priority idle process
-void idle_proc(uint32_t init_param) {
-    while(1);
+/*! System-call router
+ *
+ */
+Process * s_sys_router(Process * running, int swi_num, uint32_t * args) {
+    uint32_t slot = swi_num & ~SWI_BLOCKING;
+    SwiHandler handler = slot<SWI_SLOTS ? swi_table[(swi_num & SWI_BLOCKING) ? 1 : 0][slot] : NULL;
+    return s_sys_route(running,swi_num,args,handler);
 }
 
-uint32_t countdown_proc(uint32_t init_param) {
-    int n = init_param;
-    sys_log("countdown_proc starting");
-    while(n>0) {
-        sys_log(".");
-        sys_sleep_millis(100);
-        n--;
+/*! The router from before the dispatch table, a switch on the SWI number.
+ *
+ * Only called by swi_handler_baseline in start.S (see sys_entry_baseline).
+ */
+Process * s_sys_router_switch(Process * running, int swi_num, uint32_t * args) {
+    SwiHandler handler = NULL;
+    switch(swi_num) {
+#define SYSCALL(num,NAME,name,stub) case SWI_##NAME: handler = swi_##name; break;
+#include "syscalls.def"
+#undef SYSCALL
     }
-    sys_log("countdown_proc exiting");
-    return 0;
+    return s_sys_route(running,swi_num,args,handler);
 }
 
-void root_proc(uint32_t init_param) {
-    sys_log("root_proc is forking app_main");
-    sys_fork(app_main,0,0);
+// Low priority idle process
+void idle_proc(uint32_t init_param) {
     while(1) {
-        int c = uart_getc();
-        uart_putc(c);
-        if(c=='\n') {
-            uart_puts("\r\n*newline\r\n");
-        }
-        else if(c=='\r') {
-            uart_puts("\r\n*linefeed\r\n");
+        cpu_idle();
+    }
+}
+
+// Low priority log process; drains the kernel log ring to the console
+void klog_proc(uint32_t eid) {
+    char buff[96];
+    uint32_t overflow = 0;
+    while(1) {
+        sys_evt_wait(eid,KLOG_EVT_PENDING,EVT_WAIT_ANY|EVT_CONSUME);
+        for(const KLogRecord * r; (r = klog_first()); klog_release()) {
+            sys_write(buff,klog_format(r,buff,sizeof(buff)));
         }
-        else if(c>='1' && c<='9') {
-            sys_log("root_proc is forking a child");
-            sys_fork((ProcessMainFn)countdown_proc,(uint32_t)(c-'0'),0);
+        if(klog_overflow()!=overflow) {
+            overflow = klog_overflow();
+            sys_write(buff,ksnprintf(buff,sizeof(buff),"\033[31;1mklog: records dropped: %u\033[0m\r\n",overflow));
         }
     }
 }
+
+void root_proc(uint32_t init_param) {
+    sys_log("root_proc is forking the application");
+    sys_fork(APP_MAIN,0,0);
+    console_main();
+}
@@ -0,0 +1,41 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* svc.h
+ *
+ * Inline system calls; svc_<name>(a0,a1,a2) for each system call in
+ * syscalls.def. The SWI instruction is emitted at the call site, with the
+ * arguments already in r0-r2, so there is no branch to a sys_* stub. The
+ * result is returned in r0; r1-r3 are clobbered.
+ *
+ * Use for hot paths only; the sys_* functions in toast.h are the typed
+ * interface.
+ */
+#ifndef __SVC_H__
+#define __SVC_H__
+
+#include <stdint.h>
+#include "swi-ops.h"
+
+#ifdef __arm__
+#define SYSCALL(num,NAME,name,stub)                                         \
+static inline uint32_t svc_##name(uint32_t a0, uint32_t a1, uint32_t a2) { \
+    register uint32_t r0 __asm__("r0") = a0;                                \
+    register uint32_t r1 __asm__("r1") = a1;                                \
+    register uint32_t r2 __asm__("r2") = a2;                                \
+    __asm__ volatile("swi %[n]"                                             \
+                     : "+r"(r0), "+r"(r1), "+r"(r2)                         \
+                     : [n] "i"(num)                                         \
+                     : "r3", "memory");                                     \
+    return r0;                                                              \
+}
+#else
+// Host-native simulator (see sim.h)
+uint32_t sim_swi(uint32_t swi_num, uint32_t r0, uint32_t r1, uint32_t r2);
+#define SYSCALL(num,NAME,name,stub)                                         \
+static inline uint32_t svc_##name(uint32_t a0, uint32_t a1, uint32_t a2) { \
+    return sim_swi(num,a0,a1,a2);                                           \
+}
+#endif
+#include "syscalls.def"
+#undef SYSCALL
+
+#endif // __SVC_H__
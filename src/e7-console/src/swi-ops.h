@@ -2,23 +2,23 @@
 #ifndef __SWI_OPS__
 #define __SWI_OPS__
 
-// SWI operator values (24-bit)
-#define SWI_SET_LED      0x0001
-#define SWI_CLOCK_MILLIS 0x0002
-#define SWI_FORK         0x0003
-#define SWI_MON_CREATE   0x0004
-#define SWI_MON_EXIT     0x0005
-#define SWI_MON_NOTIFY   0x0006
-#define SWI_GET_PID      0x0007
+// SWI operator values (24-bit); SWI_<NAME> for each system call in syscalls.def
+#ifdef __ASSEMBLER__
+#define SYSCALL(num,NAME,name,stub) .equ SWI_##NAME, num;
+#include "syscalls.def"
+#undef SYSCALL
+#else
+enum {
+#define SYSCALL(num,NAME,name,stub) SWI_##NAME = num,
+#include "syscalls.def"
+#undef SYSCALL
+};
+#endif
 
 // Blocking operations
 #define SWI_BLOCKING     0x8000
-#define SWI_EXIT         0x8000
-#define SWI_YIELD        0x8001
-#define SWI_SLEEP_MILLIS 0x8002
-#define SWI_MON_ENTER    0x8003
-#define SWI_MON_WAIT     0x8004
-#define SWI_LOG          0x8005
+
+#define SWI_SLOTS        32 // Dispatch table entries for each of the two ranges
 
 #define SWI_MASK         0xFF000000
 
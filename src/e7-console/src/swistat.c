@@ -0,0 +1,92 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* swistat.c
+ *
+ * Per-SWI latency histograms. Only accessed in Supervisor-mode.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "swistat.h"
+#include "swi-ops.h"
+
+uint32_t swi_entry_cycles;
+
+// [0] non-blocking SWIs, [1] blocking SWIs; indexed by SWI number within the range
+static LatHist hists[2][SWISTAT_SLOTS];
+
+uint32_t lat_bucket(uint32_t val) {
+    if(val<LAT_SUB) {
+        return val;
+    }
+    uint32_t log2 = 31 - __builtin_clz(val);
+    uint32_t sub = (val >> (log2-LAT_SUB_BITS)) & (LAT_SUB-1);
+    return ((log2-LAT_SUB_BITS+1) << LAT_SUB_BITS) + sub;
+}
+
+uint32_t lat_bucket_max(uint32_t bucket) {
+    if(bucket<LAT_SUB) {
+        return bucket;
+    }
+    if(bucket==LAT_BUCKETS-1) {
+        return (uint32_t)(-1);
+    }
+    // One less than the smallest value in the next bucket
+    bucket++;
+    uint32_t log2 = (bucket >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    uint32_t sub = bucket & (LAT_SUB-1);
+    return ((LAT_SUB+sub) << (log2-LAT_SUB_BITS)) - 1;
+}
+
+uint32_t lat_percentile(const LatHist * h, uint32_t pct) {
+    // Rank of the sample, rounding up
+    uint32_t rank = ((uint64_t)h->count*pct + 99) / 100;
+    uint32_t seen = 0;
+    for(uint32_t b=0; b<LAT_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if(seen>=rank && seen>0) {
+            uint32_t val = lat_bucket_max(b);
+            return val<h->max ? val : h->max;
+        }
+    }
+    return h->max;
+}
+
+void swistat_record(uint32_t swi_num, uint32_t cycles) {
+    uint32_t range = (swi_num & SWI_BLOCKING) ? 1 : 0;
+    uint32_t slot = swi_num & ~SWI_BLOCKING;
+    if(slot>=SWISTAT_SLOTS) {
+        return;
+    }
+    LatHist * h = &hists[range][slot];
+    h->count++;
+    if(cycles>h->max) {
+        h->max = cycles;
+    }
+    h->buckets[lat_bucket(cycles)]++;
+}
+
+void swistat_clear(void) {
+    for(uint32_t range=0; range<2; range++) {
+        for(uint32_t slot=0; slot<SWISTAT_SLOTS; slot++) {
+            LatHist * h = &hists[range][slot];
+            h->count = 0;
+            h->max = 0;
+            for(uint32_t b=0; b<LAT_BUCKETS; b++) {
+                h->buckets[b] = 0;
+            }
+        }
+    }
+}
+
+const LatHist * swistat_next(uint32_t * swi_num) {
+    uint32_t range = (*swi_num & SWI_BLOCKING) ? 1 : 0;
+    uint32_t slot = *swi_num & ~SWI_BLOCKING;
+    for(; range<2; range++, slot=0) {
+        for(; slot<SWISTAT_SLOTS; slot++) {
+            if(hists[range][slot].count) {
+                *swi_num = (range ? SWI_BLOCKING : 0) | slot;
+                return &hists[range][slot];
+            }
+        }
+    }
+    return NULL;
+}
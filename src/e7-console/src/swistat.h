@@ -0,0 +1,43 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __SWISTAT_H__
+#define __SWISTAT_H__
+/* swistat.h
+ *
+ * System-call latency statistics. swi_handler takes a cycle-counter
+ * timestamp on entry, and s_sys_router records the cycles spent in the
+ * kernel when it returns. There is a log-linear latency histogram per SWI
+ * number, for each of the non-blocking and blocking (SWI_BLOCKING) ranges.
+ */
+#include <stdint.h>
+
+#define SWISTAT_SLOTS 32    // Histograms per range; SWI numbers beyond this are not recorded
+
+// Log-linear buckets: LAT_SUB linear sub-buckets for each power of two
+#define LAT_SUB_BITS 2
+#define LAT_SUB      (1<<LAT_SUB_BITS)
+#define LAT_BUCKETS  ((32-LAT_SUB_BITS+1)*LAT_SUB)
+
+typedef struct LatHist_S {
+    uint32_t count;     // Number of samples
+    uint32_t max;       // Largest sample
+    uint32_t buckets[LAT_BUCKETS];
+} LatHist;
+
+/*! Cycle counter at entry to the running SWI (written by swi_handler) */
+extern uint32_t swi_entry_cycles;
+
+/*! Record the latency of a SWI, in cycles */
+void swistat_record(uint32_t swi_num, uint32_t cycles);
+/*! Clear all histograms */
+void swistat_clear(void);
+/*! Returns the histogram of the first recorded SWI number >= *swi_num (and updates *swi_num), or NULL */
+const LatHist * swistat_next(uint32_t * swi_num);
+
+/*! Histogram bucket of a sample */
+uint32_t lat_bucket(uint32_t val);
+/*! Largest sample that falls into a histogram bucket */
+uint32_t lat_bucket_max(uint32_t bucket);
+/*! Returns an upper bound of the pct'th percentile of the histogram */
+uint32_t lat_percentile(const LatHist * h, uint32_t pct);
+
+#endif // __SWISTAT_H__
@@ -10,6 +10,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "ring.h"
 
 #define NULL ((void*)0)
 #define SYS_LED_BLUE     22
@@ -20,14 +21,213 @@
 // System calls
 
 uint32_t sys_set_led(uint32_t led, uint32_t val);
+
+// GPIO lines are in two banks: GPIO 0-31 and 32-53
+#define GPIO_BANK(gpio) ((gpio)>>5)
+#define GPIO_BIT(gpio)  (1UL<<((gpio)&0x1F))
+
+/*! Set, then clear, the outputs selected by the masks in one GPIO bank.
+ *
+ * Each mask is a single register write, so all the selected outputs change
+ * at once (e.g. to drive a parallel bus.) Returns 0, or non-zero for an
+ * invalid bank.
+ */
+uint32_t sys_gpio_write_mask(uint32_t bank, uint32_t set_mask, uint32_t clr_mask);
+/*! Read the levels of all GPIO lines in one bank */
+uint32_t sys_gpio_read_bank(uint32_t bank);
+
+// GPIO events (sys_gpio_irq)
+#define GPIO_EVT_RISING        0b000001 // Rising edge
+#define GPIO_EVT_FALLING       0b000010 // Falling edge
+#define GPIO_EVT_HIGH          0b000100 // High level
+#define GPIO_EVT_LOW           0b001000 // Low level
+#define GPIO_EVT_ASYNC_RISING  0b010000 // Asynchronous (unsampled) rising edge
+#define GPIO_EVT_ASYNC_FALLING 0b100000 // Asynchronous (unsampled) falling edge
+
+/*! Make a GPIO line (0-31) an input, and select the events that interrupt on it (0 for none).
+ *
+ * Events less than debounce_us microseconds after the previous (accepted)
+ * event on the line are ignored. Level events fire once per sys_gpio_wait.
+ * Returns 0, or non-zero for an invalid line.
+ */
+uint32_t sys_gpio_irq(uint32_t gpio, uint32_t events, uint32_t debounce_us);
+/*! Wait for events on any of the GPIO lines in pin_mask (GPIO_BIT(gpio), lines 0-31).
+ *
+ * Events that happened while no one was waiting are returned immediately.
+ * Returns the lines with events, or 0 if timeout_millis (0 waits forever)
+ * expired. If timestamp_us isn't NULL, it is set to the system time (in
+ * microseconds) at which the interrupt was taken.
+ */
+uint32_t sys_gpio_wait(uint32_t pin_mask, uint32_t timeout_millis, uint32_t * timestamp_us);
 void sys_yield();
 uint32_t sys_clock_millis();
+
+/*! System time in microseconds (the clock of sys_sleep_until and the GPIO timestamps).
+ *
+ * A library function, not a system call: it reads the System Timer directly
+ * and costs a few loads, so it can timestamp tight loops.
+ */
+uint64_t toast_now_us(void);
+/*! System time in milliseconds (see toast_now_us) */
+uint64_t toast_now_ms(void);
+
+// Clock frequency of the CPU (see bcm2835.h)
+#ifdef BOARD_RPI2
+#define CPU_CLOCK_HZ 900000000UL
+#else
+#define CPU_CLOCK_HZ 700000000UL
+#endif
+
+/*! Read the CPU cycle counter (wraps every ~6 seconds) */
+uint32_t sys_cycles(void);
 uint32_t sys_sleep_millis(uint32_t millis);
+/*! Sleep until the system time reaches deadline_us (microseconds; the clock of the sys_gpio_wait timestamps) */
+void sys_sleep_until(uint64_t deadline_us);
+
+/*! Create a periodic timer, whose first period starts now. Returns the timer id */
+uint32_t sys_timer_create(uint32_t period_us);
+/*! Block until the next period of the timer starts.
+ *
+ * Periods are counted from the creation of the timer, so a loop that waits
+ * on it doesn't drift. Returns the number of period starts that were missed
+ * because the caller was late (0 if it was on time).
+ */
+uint32_t sys_timer_wait(uint32_t tid);
+
+#define PID_NONE ((uint32_t)(-1))
+#define PID_ANY  ((uint32_t)(-2))
 
 typedef uint32_t (*ProcessMainFn)(uint32_t init_param);
+/*! Create a new process. Returns the pid of the new process, or PID_NONE if out of process slots
+ *
+ * priority is 0 (highest) to 255; or it with FORK_CPU(cpu) to pin the process to a core (SMP builds)
+ */
 int sys_fork(ProcessMainFn main, uint32_t init_param, uint32_t priority);
+
+#define FORK_PRIO_MASK 0xFF
+#define FORK_CPU(cpu)  (((cpu)+1)<<8) // Run only on the given core (by default, any core)
+
+/*! Create count worker processes with one system call; worker i gets init_param i.
+ *
+ * priority is as for sys_fork. Returns the number of workers created (fewer if out of process slots)
+ */
+uint32_t sys_spawn_batch(ProcessMainFn main, uint32_t count, uint32_t priority);
+
+// Wait results (otherwise the pid of the reaped child)
+#define W_NO_CHILD ((uint32_t)(-1)) // No matching child process
+#define W_RUNNING  ((uint32_t)(-2)) // Matching children are still running (sys_try_wait)
+
+/*! Block until a child process (pid, or PID_ANY) terminates, and reap it */
+uint32_t sys_wait(uint32_t pid, uint32_t * exit_code);
+/*! Reap a terminated child process (pid, or PID_ANY), without blocking */
+uint32_t sys_try_wait(uint32_t pid, uint32_t * exit_code);
 void sys_log(const char * str);
+/*! Read from the console. Blocks until at least one byte is available. Returns the number of bytes read */
+uint32_t sys_read(void * buf, uint32_t len);
+/*! Write to the console. Blocks until all bytes have been buffered. Returns the number of bytes written */
+uint32_t sys_write(const void * buf, uint32_t len);
 uint32_t sys_get_pid(void);
+
+// Process states (ProcInfo.state)
+#define PS_RUNNING   0  // Running
+#define PS_READY     1  // Ready to run
+#define PS_SLEEPING  2  // Sleeping
+#define PS_MON_ENTER 3  // Waiting to enter a monitor; wait_id = mid
+#define PS_MON_WAIT  4  // Waiting for a monitor notification; wait_id = mid
+#define PS_SEM       5  // Waiting for a semaphore; wait_id = sid
+#define PS_EVT       6  // Waiting for event flags; wait_id = eid
+#define PS_CHILD     7  // Waiting for a child process; wait_id = pid (or PID_ANY)
+#define PS_READ      8  // Waiting for console input
+#define PS_WRITE     9  // Waiting for console output
+#define PS_ZOMBIE    10 // Terminated, not yet reaped
+#define PS_GPIO      11 // Waiting for GPIO events; wait_id = pin mask
+#define PS_ANY       12 // Waiting for any of several event sources (sys_wait_any); wait_id = number of sources
+
+typedef struct ProcInfo_S {
+    uint32_t pid;           // Process identifier
+    uint32_t parent_pid;    // Parent process identifier (or PID_NONE)
+    uint32_t priority;      // Scheduling priority
+    uint32_t state;         // Process state (PS_*)
+    uint32_t wait_id;       // Identifier of the object the process is blocked on
+    uint32_t ticks;         // Timer ticks charged to the process
+    uint32_t switches;      // Number of times the process has been switched to
+} ProcInfo;
+
+/*! Get a snapshot of the first process with a pid >= the given pid.
+ *
+ * Returns the pid of the process, or PID_NONE if there are no more processes.
+ * Does not block, so processes can be listed without stopping the scheduler.
+ */
+uint32_t sys_proc_info(uint32_t pid, ProcInfo * info);
+
+// Sampling profiler
+typedef struct ProfSample_S {
+    uint32_t pid;           // Sampled process
+    uint32_t pc;            // Sampled program counter (0 counts samples that didn't fit the histogram)
+    uint32_t count;         // Number of samples
+} ProfSample;
+
+#define PROF_NONE ((uint32_t)(-1))
+
+/*! Clear the profile, and sample the running process every period timer ticks (0 stops sampling) */
+void sys_prof_ctl(uint32_t period);
+/*! Get the first profile histogram entry at or after index.
+ *
+ * Returns the index of the entry, or PROF_NONE if there are no more entries.
+ */
+uint32_t sys_prof_read(uint32_t index, ProfSample * sample);
+
+// System-call latency statistics
+typedef struct SwiStat_S {
+    uint32_t swi;           // SWI number
+    uint32_t count;         // Number of calls
+    uint32_t p50;           // Median latency, in cycles
+    uint32_t p99;           // 99th percentile latency, in cycles
+    uint32_t max;           // Worst-case latency, in cycles
+} SwiStat;
+
+#define SWI_NONE ((uint32_t)(-1))
+
+/*! Get the latency statistics of the first called SWI number >= swi.
+ *
+ * Latency is measured from SWI entry until the kernel returns to a process
+ * (for blocking SWIs, until it switches away from the calling process.)
+ * Returns the SWI number, or SWI_NONE if there are no more SWIs. If stat is
+ * NULL, all statistics are cleared.
+ */
+uint32_t sys_swi_stat(uint32_t swi, SwiStat * stat);
+
+// Performance monitor; ARM1176 PMU events (ARM1176JZF-S TRM 3.2.51)
+#define PERF_EVT_ICACHE_MISS    0x00 // Instruction cache miss
+#define PERF_EVT_IBUF_STALL     0x01 // Stall; instruction buffer can't deliver
+#define PERF_EVT_DATA_STALL     0x02 // Stall; data dependency
+#define PERF_EVT_IMTLB_MISS     0x03 // Instruction MicroTLB miss
+#define PERF_EVT_DMTLB_MISS     0x04 // Data MicroTLB miss
+#define PERF_EVT_BRANCH         0x05 // Branch instruction executed
+#define PERF_EVT_BRANCH_MISS    0x06 // Branch mispredicted
+#define PERF_EVT_INSTR          0x07 // Instruction executed
+#define PERF_EVT_DCACHE_ACCESS  0x09 // Data cache access (cacheable)
+#define PERF_EVT_DCACHE_MISS    0x0B // Data cache miss
+#define PERF_EVT_DCACHE_WB      0x0C // Data cache write-back
+#define PERF_EVT_TLB_MISS       0x0F // Main TLB miss
+
+typedef struct PerfStat_S {
+    uint64_t cycles;        // CPU cycles
+    uint32_t events[2];     // Event counts
+    uint32_t types[2];      // Events counted (PERF_EVT_*)
+} PerfStat;
+
+// Whose counts to get with sys_perf_read
+#define PERF_SELF     0     // The process itself
+#define PERF_CHILDREN 1     // Reaped children of the process (and their descendants)
+
+/*! Select the two events counted per process, and clear the counts of all processes */
+void sys_perf_ctl(uint32_t evt0, uint32_t evt1);
+/*! Get the PMU counts charged to a process, or to its reaped children.
+ *
+ * Returns the pid, or PID_NONE if there is no such process.
+ */
+uint32_t sys_perf_read(uint32_t pid, uint32_t whose, PerfStat * stat);
 _Noreturn uint32_t sys_exit(uint32_t exit_code);
 uint32_t sys_mon_create();
 uint32_t sys_mon_enter(uint32_t mid);
@@ -35,4 +235,69 @@ void sys_mon_exit(uint32_t mid);
 void sys_mon_wait(uint32_t mid);
 void sys_mon_notify(uint32_t mid);
 
+uint32_t sys_sem_create(uint32_t count);
+void sys_sem_wait(uint32_t sid);
+void sys_sem_signal(uint32_t sid);
+
+// Event wait modes
+#define EVT_WAIT_ANY 0b00000000 // Wait for any of the flags in the mask
+#define EVT_WAIT_ALL 0b00000001 // Wait for all of the flags in the mask
+#define EVT_CONSUME  0b00000010 // Clear the matched flags when the wait is satisfied
+
+uint32_t sys_evt_create();
+/*! Block until the flags in mask are set (see EVT_WAIT_*). Returns the matched flags */
+uint32_t sys_evt_wait(uint32_t eid, uint32_t mask, uint32_t mode);
+void sys_evt_set(uint32_t eid, uint32_t mask);
+void sys_evt_clear(uint32_t eid, uint32_t mask);
+
+// Event sources (sys_wait_any)
+#define WAIT_SRC_MON     1 // Monitor is free; id = mid
+#define WAIT_SRC_SEM     2 // Semaphore count is non-zero; id = sid
+#define WAIT_SRC_EVT     3 // Any of the event flags in mask are set; id = eid
+#define WAIT_SRC_READ    4 // Console input is available
+#define WAIT_SRC_GPIO    5 // Event on any of the GPIO lines (0-31) in mask
+#define WAIT_SRC_CHILD   6 // Child process has terminated (or there is none); id = pid (or PID_ANY)
+#define WAIT_SRC_TIMEOUT 7 // Timeout; id = milliseconds
+
+#define WAIT_ANY_MAX     4                // Event sources per sys_wait_any
+#define WAIT_ANY_ILLEGAL ((uint32_t)(-1)) // Invalid event source
+
+typedef struct WaitSource_S {
+    uint32_t type;  // WAIT_SRC_*
+    uint32_t id;    // See WAIT_SRC_*
+    uint32_t mask;  // Event flags (WAIT_SRC_EVT) or GPIO_BIT lines (WAIT_SRC_GPIO)
+} WaitSource;
+
+/*! Block until any of the event sources is ready. Returns the index of the first ready source.
+ *
+ * Nothing is consumed: follow up with the call for that source (sys_read,
+ * sys_wait, sys_mon_enter, ...), which doesn't block unless another process
+ * got there first. Returns WAIT_ANY_ILLEGAL for an invalid source.
+ */
+uint32_t sys_wait_any(const WaitSource * sources, uint32_t count);
+
+// Submission/completion rings; the Ring layout, ring_submit and ring_complete are in ring.h
+
+/*! Register (and reset) the rings of the calling process; NULL unregisters.
+ *
+ * With RING_POLL, posted operations are also processed when a core has
+ * nothing else to run, without a system call. A RING_OP_MON_NOTIFY still
+ * waits for sys_ring_enter.
+ */
+void sys_ring_setup(Ring * ring, uint32_t flags);
+/*! Process the posted operations, in order, with one trap.
+ *
+ * Posts a completion for each; stops early if the completion ring is full.
+ * Returns the number of operations processed.
+ */
+uint32_t sys_ring_enter(void);
+
+/*! For benchmarks: route every SWI through the entry path from before
+ * syscalls.def (saves all of r0-r12, and switches on the SWI number) if
+ * baseline is true, or through the normal one if false.
+ */
+void sys_entry_baseline(bool baseline);
+/*! sys_get_pid through the stub from before syscalls.def (push/pop of lr) */
+uint32_t sys_get_pid_baseline(void);
+
 #endif // __TOAST_H__
@@ -0,0 +1,48 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+/* trace.c
+ *
+ * Kernel event trace ring. Records are only written in Supervisor- and
+ * IRQ-mode, with interrupts disabled.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include "trace.h"
+#include "bcm2835.h"
+#include "kprintf.h"
+
+static struct {
+    uint32_t head;      // next record to write
+    uint32_t dropped;   // records not written because the ring was full
+    TraceRecord records[TRACE_RECORDS];
+} trace_ring;
+
+void trace_record(uint32_t type, uint32_t pid, uint32_t arg) {
+    if(!TRACE_FLIGHT_RECORDER && trace_ring.head==TRACE_RECORDS) {
+        trace_ring.dropped++;
+        return;
+    }
+    TraceRecord * r = &trace_ring.records[trace_ring.head++ & (TRACE_RECORDS-1)];
+    r->cycles = cycle_counter();
+    r->type = type | cpu_id()<<TR_CPU_SHIFT;
+    r->pid = pid;
+    r->arg = arg;
+}
+
+/*
+ * Dump format (one record per line, as two little-endian words in hex):
+ *   TRACE-BEGIN <records> <dropped> <cycles per second>
+ *   <cycles> <type|cpu<<4|pid<<8|arg<<16>
+ *   TRACE-END
+ */
+void trace_dump() {
+    uint32_t count = trace_ring.head<TRACE_RECORDS ? trace_ring.head : TRACE_RECORDS;
+    uint32_t first = trace_ring.head - count;
+    kprintf("TRACE-BEGIN %u %u %u\r\n",count,trace_ring.dropped,CPU_CLOCK_HZ);
+    for(uint32_t i=first; i!=trace_ring.head; i++) {
+        const uint32_t * words = (const uint32_t *)&trace_ring.records[i & (TRACE_RECORDS-1)];
+        kprintf("%08x %08x\r\n",words[0],words[1]);
+        uart_flush();
+    }
+    kprintf("TRACE-END\r\n");
+    uart_flush();
+}
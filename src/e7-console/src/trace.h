@@ -0,0 +1,53 @@
+// Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#ifndef __TRACE_H__
+#define __TRACE_H__
+/* trace.h
+ *
+ * Binary kernel event tracer. Compact records, timestamped with the ARM
+ * cycle counter, are written to a ring buffer. In flight-recorder mode the
+ * ring keeps the most recent events, and is dumped to the console on panic.
+ * Use tools/trace2chrome.py to convert a dump into Chrome trace JSON.
+ */
+#include <stdint.h>
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Keep the most recent events (1), or stop when the ring is full (0)
+#ifndef TRACE_FLIGHT_RECORDER
+#define TRACE_FLIGHT_RECORDER 1
+#endif
+
+// Trace record types
+#define TR_SWITCH      1   // Context switch; arg = pid of next process
+#define TR_SWI_ENTER   2   // System call entry; arg = swi_num
+#define TR_SWI_EXIT    3   // System call exit; arg = swi_num
+#define TR_IRQ         4   // Interrupt; arg = basic pending IRQs
+#define TR_MON_ENTER   5   // Monitor enter; arg = mid
+#define TR_MON_EXIT    6   // Monitor exit; arg = mid
+#define TR_MON_WAIT    7   // Monitor wait; arg = mid
+#define TR_MON_NOTIFY  8   // Monitor notify; arg = mid
+#define TR_SLEEP       9   // Process put to sleep
+#define TR_ROUSE       10  // Process roused from sleep
+
+#define TR_TYPE_MASK  0x0F
+#define TR_CPU_SHIFT  4    // The core that wrote the record, in the high nibble of type
+
+typedef struct TraceRecord_S {
+    uint32_t cycles;    // Cycle counter
+    uint8_t type;       // Record type (TR_*) | core number << TR_CPU_SHIFT
+    uint8_t pid;        // Process identifier
+    uint16_t arg;       // Type-specific argument
+} TraceRecord;
+
+#define TRACE_RECORDS 1024 // must be a power of 2
+
+/*! Record an event */
+void trace_record(uint32_t type, uint32_t pid, uint32_t arg);
+/*! Write the trace ring to the console, polling (for use with interrupts disabled) */
+void trace_dump();
+
+#define TRACE(type,pid,arg) { if(TRACE_ENABLED) { trace_record(type,pid,arg); } }
+
+#endif // __TRACE_H__
@@ -12,6 +12,26 @@ int gpio_write(unsigned int gpio, unsigned int level) {
     return 0;
 }
 
+int gpio_write_mask(unsigned int bank, uint32_t set_mask, uint32_t clr_mask) {
+    return 0;
+}
+
+uint32_t gpio_read_bank(unsigned int bank) {
+    return 0;
+}
+
+int gpio_irq_config(unsigned int gpio, unsigned int events) {
+    return 0;
+}
+
+bool gpio_irq_pending() {
+    return false;
+}
+
+uint32_t gpio_irq() {
+    return 0;
+}
+
 void uart_init(Baud baud) {
     
 }
@@ -36,12 +56,35 @@ uint8_t uart_getc() {
     return getc(stdin);
 }
 
+uint32_t uart_read(uint8_t * buf, uint32_t len) {
+    return 0;
+}
+
+uint32_t uart_rx_count(void) {
+    return 0;
+}
+
+uint32_t uart_write(const uint8_t * buf, uint32_t len) {
+    return fwrite(buf,1,len,stdout);
+}
+
+void uart_flush() {
+    fflush(stdout);
+}
+
 uint64_t system_timer(void) {
     struct timeval tv;
     gettimeofday(&tv,NULL);
     return tv.tv_sec*(uint64_t)1000000+tv.tv_usec;
 }
 
+uint32_t cycle_counter(void) {
+    // 1 "cycle" per microsecond on the host
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return tv.tv_sec*(uint32_t)1000000+tv.tv_usec;
+}
+
 void panic(int code) {
     printf("PANIC: code=%d\n",code);
     exit(code);
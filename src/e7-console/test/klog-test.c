@@ -0,0 +1,24 @@
+#include <stddef.h>
+#define KLOG_LEVEL KLOG_WARN // as in `make qemu-bench`
+#include "klog.h"
+#include "proctl.h"
+#include "assert.h"
+
+static void test_level() {
+    // below the threshold: never reaches the ring, and isn't counted as an overflow
+    klog(KLOG_INFO,PID_NONE,"info");
+    ASSERT(klog_begin(KLOG_DEBUG,PID_NONE)==NULL,1)
+    ASSERT(klog_first()==NULL,1)
+    ASSERT(klog_overflow()==0,1)
+    // at the threshold
+    klog(KLOG_WARN,PID_NONE,"warn");
+    const KLogRecord * r = klog_first();
+    ASSERT(r!=NULL && r->level==KLOG_WARN && r->len==4,1)
+    klog_release();
+    ASSERT(klog_first()==NULL,1)
+}
+
+int main(int argc, char ** argv) {
+    test_level();
+    return 0;
+}
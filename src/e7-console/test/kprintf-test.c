@@ -0,0 +1,70 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include "kprintf.h"
+#include "assert.h"
+
+static bool streq(const char * a, const char * b) {
+    while(*a && *a==*b) {
+        a++;
+        b++;
+    }
+    return *a==*b;
+}
+
+static bool formats(const char * expect, const char * fmt, ...) {
+    char buf[64];
+    va_list args;
+    va_start(args,fmt);
+    uint32_t len = kvsnprintf(buf,sizeof(buf),fmt,args);
+    va_end(args);
+    uint32_t expect_len = 0;
+    while(expect[expect_len]) {
+        expect_len++;
+    }
+    return len==expect_len && streq(buf,expect);
+}
+
+static void test_division() {
+    // reciprocal division agrees with the compiler's division
+    for(uint32_t v=0; v<1000000; v++) {
+        ASSERT(udiv10(v)==v/10,1)
+    }
+    for(uint32_t v=0xFFFFFFFF; v>0xFFFFFFFF-1000000; v--) {
+        ASSERT(udiv10(v)==v/10,1)
+    }
+    uint64_t v = 0x123456789ABCDEFULL;
+    for(int i=0; i<1000000; i++) {
+        ASSERT(udiv10_u64(v)==v/10,1)
+        ASSERT(udiv1000_u64(v)==v/1000,1)
+        v = v*6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    ASSERT(udiv10_u64(0xFFFFFFFFFFFFFFFFULL)==0xFFFFFFFFFFFFFFFFULL/10,1)
+    ASSERT(udiv1000_u64(0xFFFFFFFFFFFFFFFFULL)==0xFFFFFFFFFFFFFFFFULL/1000,1)
+    ASSERT(udiv1000_u64(999)==0 && udiv1000_u64(1000)==1,1)
+}
+
+static void test_formats() {
+    ASSERT(formats("plain","plain"),1)
+    ASSERT(formats("0 -1 42","%d %i %d",0,-1,42),1)
+    ASSERT(formats("-2147483648 2147483647","%d %d",(int32_t)0x80000000,0x7FFFFFFF),1)
+    ASSERT(formats("4294967295","%u",0xFFFFFFFFU),1)
+    ASSERT(formats("18446744073709551615","%llu",0xFFFFFFFFFFFFFFFFULL),1)
+    ASSERT(formats("-9223372036854775808","%lld",(int64_t)0x8000000000000000ULL),1)
+    ASSERT(formats("12345678901","%llu",12345678901ULL),1)
+    ASSERT(formats("deadbeef DEADBEEF","%x %X",0xDEADBEEF,0xDEADBEEF),1)
+    ASSERT(formats("123456789abcdef0","%llx",0x123456789ABCDEF0ULL),1)
+    ASSERT(formats("0000002a|   42|42   |-0042","%08x|%5u|%-5d|%05d",42,42,42,-42),1)
+    ASSERT(formats("a|  hi|hi  |100%","%c|%4s|%-4s|100%%",'a',"hi","hi"),1)
+    ASSERT(formats("%q","%q"),1)
+
+    // truncation: NUL terminated, returns the untruncated length
+    char buf[8];
+    ASSERT(ksnprintf(buf,sizeof(buf),"%u-%u",123456,7890)==11,1)
+    ASSERT(streq(buf,"123456-"),1)
+}
+
+int main(int argc, char ** argv) {
+    test_division();
+    test_formats();
+    return 0;
+}
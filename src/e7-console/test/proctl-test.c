@@ -1,6 +1,331 @@
+#include <stddef.h>
 #include "proctl.h"
+#include "arm.h"
+#include "assert.h"
+
+static void test_semaphore() {
+    Process * p = p_create(NULL,0,0,1);
+    uint32_t sid = sem_create(1);
+    ASSERT(sem_wait(p,sid)==M_OK,1)
+    ASSERT(sem_wait(p,sid)==M_BLOCKED,1)
+    ASSERT(sem_signal(sid)==M_OK,1)
+    // the signal is handed directly to the waiting process
+    ASSERT(p->registers[0]==M_OK,1)
+    ASSERT(p_pop_ready()==p,1)
+    ASSERT(sem_signal(sid)==M_OK,1)
+    ASSERT(sem_wait(p,sid)==M_OK,1)
+}
+
+static void test_event_flags() {
+    Process * p1 = p_create(NULL,0,0,1);
+    Process * p2 = p_create(NULL,0,0,2);
+    uint32_t eid = evt_create();
+    ASSERT(evt_wait(p1,eid,0b011,EVT_WAIT_ALL)==0,1)
+    ASSERT(evt_wait(p2,eid,0b110,EVT_WAIT_ANY|EVT_CONSUME)==0,1)
+    ASSERT(evt_set(eid,0b001)==M_OK,1)
+    // neither wait is satisfied, so both stay blocked
+    ASSERT(p1->state==PS_EVT && p1->wait_id==eid,1)
+    ASSERT(p2->state==PS_EVT && p2->wait_id==eid,1)
+    evt_set(eid,0b010);
+    // both are woken with the flags that satisfied their waits
+    ASSERT(p1->state==PS_READY && p2->state==PS_READY,1)
+    ASSERT(p1->registers[0]==0b011,1)
+    ASSERT(p2->registers[0]==0b010,1)
+    ASSERT(p_pop_ready()==p1,1)
+    ASSERT(p_pop_ready()==p2,1)
+    // p2 consumed its flag
+    ASSERT(evt_wait(p1,eid,0b011,EVT_WAIT_ANY)==0b001,1)
+    evt_clear(eid,0b001);
+    ASSERT(evt_wait(p1,eid,0b001,EVT_WAIT_ANY)==0,1)
+    ASSERT(evt_set(eid,0b001)==M_OK,1)
+    ASSERT(p_pop_ready()==p1,1)
+}
+
+static void test_reaping() {
+    Process * parent = p_create(NULL,0,0,1);
+    Process * child = p_create(parent,0,0,1);
+    uint32_t child_pid = child->pid;
+    uint32_t exit_code = 0;
+    ASSERT(p_wait(parent,PID_ANY,&exit_code,WAIT_NOHANG)==W_RUNNING,1)
+    p_terminate(child,7);
+    ASSERT(child->flags & P_ZOMBIE,1)
+    ASSERT(p_wait(parent,PID_ANY,&exit_code,0)==child_pid,1)
+    ASSERT(exit_code==7,1)
+    ASSERT(child->flags==0,1)
+    ASSERT(p_wait(parent,PID_ANY,&exit_code,0)==W_NO_CHILD,1)
+
+    // the freed slot is recycled
+    child = p_create(parent,0,0,1);
+    ASSERT(child->pid==child_pid,1)
+    ASSERT(p_wait(parent,child_pid,&exit_code,0)==W_BLOCKED,1)
+    p_terminate(child,9);
+    ASSERT(child->flags==0,1)
+    ASSERT(parent->registers[0]==child_pid,1)
+    ASSERT(exit_code==9,1)
+    ASSERT(p_pop_ready()==parent,1)
+
+    // orphans are reparented, and reaped as soon as they terminate
+    child = p_create(parent,0,0,1);
+    p_terminate(parent,0);
+    ASSERT(parent->flags==0,1)
+    ASSERT(child->parent_pid==PID_NONE,1)
+    p_terminate(child,0);
+    ASSERT(child->flags==0,1)
+}
+
+static void test_state() {
+    Process * p = p_create(NULL,0,0,1);
+    uint32_t sid = sem_create(0);
+    ASSERT(sem_wait(p,sid)==M_BLOCKED,1)
+    ASSERT(p->state==PS_SEM && p->wait_id==sid,1)
+    ASSERT(p_next(p->pid)==p,1)
+    sem_signal(sid);
+    ASSERT(p->state==PS_READY,1)
+    ASSERT(p_pop_ready()==p,1)
+    ASSERT(p->state==PS_RUNNING,1)
+    p_terminate(p,0);
+    ASSERT(p_next(p->pid)!=p,1)
+}
+
+static void test_perf_children() {
+    Process * parent = p_create(NULL,0,0,1);
+    Process * child = p_create(parent,0,0,1);
+    Process * grandchild = p_create(child,0,0,1);
+    ASSERT(parent->perf_children.cycles==0 && child->perf.cycles==0,1)
+    grandchild->perf.cycles = 5;
+    grandchild->perf.events[1] = 2;
+    ASSERT(p_wait(child,PID_ANY,NULL,WAIT_NOHANG)==W_RUNNING,1)
+    p_terminate(grandchild,0);
+    ASSERT(p_wait(child,PID_ANY,NULL,0)==grandchild->pid,1)
+    child->perf.cycles = 10;
+    child->perf.events[0] = 1;
+    // reaped by a parent that is already waiting
+    ASSERT(p_wait(parent,PID_ANY,NULL,0)==W_BLOCKED,1)
+    p_terminate(child,0);
+    ASSERT(parent->perf_children.cycles==15,1)
+    ASSERT(parent->perf_children.events[0]==1,1)
+    ASSERT(parent->perf_children.events[1]==2,1)
+    ASSERT(p_pop_ready()==parent,1)
+}
+
+static void test_gpio_wait() {
+    Process * p1 = p_create(NULL,0,0,1);
+    Process * p2 = p_create(NULL,0,0,2);
+    uint32_t t1 = 0;
+    uint32_t t2 = 0;
+    ASSERT(gpio_configure(17,1,0)==0,1)
+    ASSERT(gpio_configure(18,1,1000)==0,1)
+    ASSERT(gpio_configure(32,1,0)!=0,1)
+    ASSERT(gpio_wait(p1,1<<17,0,&t1)==0,1)
+    ASSERT(gpio_wait(p2,(1<<17)|(1<<18),0,&t2)==0,1)
+    ASSERT(p1->state==PS_GPIO,1)
+    // both waiters see the event, and its timestamp
+    gpio_events(1<<17,100);
+    ASSERT(p1->registers[0]==(1<<17) && t1==100,1)
+    ASSERT(p2->registers[0]==(1<<17) && t2==100,1)
+    ASSERT(p_pop_ready()==p1,1)
+    ASSERT(p_pop_ready()==p2,1)
+
+    // events without a waiter are kept for the next wait
+    gpio_events(1<<18,200);
+    ASSERT(gpio_wait(p2,1<<18,0,&t2)==(1<<18) && t2==200,1)
+    // debounced: less than 1000us since the last accepted event
+    gpio_events(1<<18,900);
+    ASSERT(gpio_wait(p2,1<<18,0,&t2)==0,1)
+    gpio_events(1<<18,1300);
+    ASSERT(p2->registers[0]==(1<<18) && t2==1300,1)
+    ASSERT(p_pop_ready()==p2,1)
+
+    // timeout: roused from the sleep queue
+    ASSERT(gpio_wait(p1,1<<17,5000,&t1)==0,1)
+    p_rouse(4999);
+    ASSERT(p1->state==PS_GPIO,1)
+    p_rouse(5000);
+    ASSERT(p_pop_ready()==p1,1)
+    // a later event doesn't wake it again
+    gpio_events(1<<17,6000);
+    ASSERT(p1->state==PS_RUNNING,1)
+    ASSERT(gpio_wait(p1,1<<17,0,&t1)==(1<<17),1)
+
+    // an event cancels the timeout
+    ASSERT(gpio_wait(p1,1<<17,8000,&t1)==0,1)
+    gpio_events(1<<17,7000);
+    ASSERT(p_pop_ready()==p1,1)
+    p_rouse(9000);
+    ASSERT(p1->state==PS_RUNNING,1)
+}
+
+static void test_free_slots() {
+    // exhaust the process slots
+    Process * procs[32];
+    uint32_t n = 0;
+    while(n<32 && (procs[n] = p_create(NULL,0,0,1))) {
+        n++;
+    }
+    ASSERT(n>0 && n<32,1)
+    ASSERT(p_create(NULL,0,0,1)==NULL,1)
+    // a recycled slot is reused first
+    Process * p = procs[n/2];
+    uint32_t pid = p->pid;
+    p_terminate(p,0);
+    p = p_create(NULL,0,0,1);
+    ASSERT(p && p->pid==pid && p->q_next==NULL,1)
+    ASSERT(p_create(NULL,0,0,1)==NULL,1)
+    p_init();
+}
+
+static void test_layout() {
+    ASSERT(offsetof(Process,registers)==PROC_REGS_OFFSET,1)
+    // the fields read on queue walks share a cache line
+    ASSERT(offsetof(Process,magic)/CACHE_LINE==offsetof(Process,sched_prio)/CACHE_LINE,1)
+    // the (large) wait union is cold
+    ASSERT(offsetof(Process,wait)>offsetof(Process,perf_children),1)
+    Process * p = p_create(NULL,0,0,1);
+    ASSERT(((uintptr_t)p % CACHE_LINE)==0,1)
+    ASSERT(p->stack->magic==STACK_MAGIC,1)
+    ASSERT(p->registers[R_SP]==(uint32_t)(uintptr_t)&p->stack->mem[STACK_SIZE],1)
+    p_init();
+}
+
+static void test_wait_any() {
+    p_init(); // needs free slots for three children
+    Process * p = p_create(NULL,0,0,1);
+    uint32_t eid = evt_create();
+    uint32_t sid = sem_create(0);
+    WaitSpec src[] = {
+        { WAIT_SRC_EVT, eid, 0b10 },
+        { WAIT_SRC_SEM, sid, 0 },
+        { WAIT_SRC_TIMEOUT, 5, 0 },
+    };
+    ASSERT(p_wait_any(p,src,0,0)==WAIT_ANY_ILLEGAL,1)
+    // a source that is ready now is returned immediately
+    evt_set(eid,0b10);
+    ASSERT(p_wait_any(p,src,3,0)==0,1)
+    evt_clear(eid,0b10);
+    // blocked on all three; the first signalled source wins
+    ASSERT(p_wait_any(p,src,3,0)==WAIT_ANY_BLOCKED,1)
+    ASSERT(p->state==PS_ANY,1)
+    evt_set(eid,0b01);
+    ASSERT(p->state==PS_ANY,1)
+    ASSERT(sem_signal(sid)==M_OK,1)
+    ASSERT(p->state==PS_READY && p->registers[0]==1,1)
+    ASSERT(p_pop_ready()==p,1)
+    // nothing was consumed
+    ASSERT(sem_wait(p,sid)==M_OK,1)
+    // the other registrations were removed
+    evt_set(eid,0b10);
+    p_rouse(10000);
+    ASSERT(p->state==PS_RUNNING,1)
+    evt_clear(eid,0b10);
+    // timeout
+    ASSERT(p_wait_any(p,src,3,1000000)==WAIT_ANY_BLOCKED,1)
+    p_rouse(1004999);
+    ASSERT(p->state==PS_ANY,1)
+    p_rouse(1005000);
+    ASSERT(p->state==PS_READY && p->registers[0]==2,1)
+    ASSERT(p_pop_ready()==p,1)
+    // child exit
+    Process * child = p_create(p,0,0,1);
+    WaitSpec child_src[] = {
+        { WAIT_SRC_SEM, sid, 0 },
+        { WAIT_SRC_CHILD, PID_ANY, 0 },
+    };
+    ASSERT(p_wait_any(p,child_src,2,0)==WAIT_ANY_BLOCKED,1)
+    p_terminate(child,0);
+    ASSERT(p->state==PS_READY && p->registers[0]==1,1)
+    ASSERT(p_pop_ready()==p,1)
+    ASSERT(p_wait_any(p,child_src,2,0)==1,1)
+    ASSERT(p_wait(p,PID_ANY,NULL,0)==child->pid,1)
+    // PID_ANY with a zombie and a running child: ready, as p_wait would reap the zombie
+    Process * running = p_create(p,0,0,1);
+    Process * zombie = p_create(p,0,0,1);
+    p_terminate(zombie,0);
+    ASSERT(p_wait_any(p,child_src,2,0)==1,1)
+    ASSERT(p_wait(p,PID_ANY,NULL,0)==zombie->pid,1)
+    // only the running child is left
+    ASSERT(p_wait_any(p,child_src,2,0)==WAIT_ANY_BLOCKED,1)
+    p_terminate(running,0);
+    ASSERT(p->state==PS_READY && p->registers[0]==1,1)
+    p_init();
+}
+
+static void test_timer() {
+    Process * p = p_create(NULL,0,0,1);
+    uint32_t tid = tmr_create(1000,5000);
+    // on time: sleep until the end of the first period
+    ASSERT(tmr_wait(p,tid,5100)==T_BLOCKED,1)
+    ASSERT(p->state==PS_SLEEPING,1)
+    p_rouse(5999);
+    ASSERT(p->state==PS_SLEEPING,1)
+    p_rouse(6000);
+    ASSERT(p_pop_ready()==p,1)
+    // the next period starts at 7000, however late the process ran
+    ASSERT(tmr_wait(p,tid,6900)==T_BLOCKED,1)
+    p_rouse(7000);
+    ASSERT(p_pop_ready()==p,1)
+    // late by 2.5 periods: two period starts (8000, 9000) are skipped
+    ASSERT(tmr_wait(p,tid,10500)==2,1)
+    ASSERT(tmr_wait(p,tid,10600)==T_BLOCKED,1)
+    p_rouse(11000);
+    ASSERT(p_pop_ready()==p,1)
+    p_init();
+}
+
+static void test_ring() {
+    static Ring ring;
+    Process * p = p_create(NULL,0,0,1);
+    Process * q = p_create(NULL,0,0,1);
+    uint32_t mid = m_create();
+    uint32_t sid = sem_create(0);
+    uint32_t eid = evt_create();
+    ASSERT(ring_enter(p)==0,1)
+    ring_setup(p,&ring,0);
+    ASSERT(m_enter(p,mid)==M_OK,1)
+    ASSERT(ring_submit(&ring,RING_OP_EVT_SET,eid,0x5,0,0),1)
+    ASSERT(ring_submit(&ring,RING_OP_SEM_SIGNAL,sid,0x5,0,1),1)
+    ASSERT(ring_submit(&ring,99,0,0x5,0,2),1)
+    ASSERT(ring_submit(&ring,RING_OP_MON_NOTIFY,mid,0x5,0,3),1)
+    // processed in order, one completion each
+    ASSERT(ring_enter(p)==4,1)
+    ASSERT(ring.sq_head==4 && ring.cq_tail==4,1)
+    ASSERT(ring.cq[0].user_data==0 && ring.cq[0].res==M_OK,1)
+    ASSERT(ring.cq[1].user_data==1 && ring.cq[1].res==M_OK,1)
+    ASSERT(ring.cq[2].user_data==2 && ring.cq[2].res==RING_ILLEGAL_OP,1)
+    ASSERT(ring.cq[3].user_data==3 && ring.cq[3].res==M_OK,1)
+    ASSERT(evt_wait(q,eid,0x5,EVT_WAIT_ALL)==0x5,1)
+    ASSERT(sem_wait(q,sid)==M_OK,1)
+    // stops when the completion ring is full
+    for(uint32_t i=0; i<RING_ENTRIES; i++) {
+        ASSERT(ring_submit(&ring,RING_OP_NOP,0,0x5,0,i),1)
+    }
+    ASSERT(ring_enter(p)==RING_ENTRIES-4,1)
+    ring.cq_head = ring.cq_tail;
+    ASSERT(ring_enter(p)==4,1)
+    ASSERT(ring.cq[(ring.cq_tail-1) & (RING_ENTRIES-1)].user_data==RING_ENTRIES-1,1)
+    // polled: drained without ring_enter, up to a monitor notify
+    ring_setup(p,&ring,RING_POLL);
+    ASSERT(ring_submit(&ring,RING_OP_SEM_SIGNAL,sid,0x5,0,0),1)
+    ASSERT(ring_submit(&ring,RING_OP_MON_NOTIFY,mid,0x5,0,1),1)
+    ASSERT(ring_submit(&ring,RING_OP_NOP,0,0x5,0,2),1)
+    ASSERT(ring_poll()==1,1)
+    ASSERT(sem_wait(q,sid)==M_OK,1)
+    ASSERT(ring_enter(p)==2,1)
+    ASSERT(ring_poll()==0,1)
+    p_init();
+}
 
 int main(int argc, char ** argv) {
     p_init();
+    test_free_slots();
+    test_layout();
+    test_semaphore();
+    test_event_flags();
+    test_reaping();
+    test_state();
+    test_perf_children();
+    test_gpio_wait();
+    test_wait_any();
+    test_timer();
+    test_ring();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,53 @@
+#include <stddef.h>
+#include "swistat.h"
+#include "swi-ops.h"
+#include "assert.h"
+
+static void test_buckets() {
+    // linear below LAT_SUB, then LAT_SUB buckets per power of two
+    for(uint32_t v=0; v<2*LAT_SUB; v++) {
+        ASSERT(lat_bucket(v)==v,1)
+    }
+    ASSERT(lat_bucket(8)==lat_bucket(9),1)
+    ASSERT(lat_bucket(10)==lat_bucket(9)+1,1)
+    ASSERT(lat_bucket((uint32_t)(-1))==LAT_BUCKETS-1,1)
+    // bucket bounds are contiguous
+    for(uint32_t b=0; b<LAT_BUCKETS-1; b++) {
+        uint32_t max = lat_bucket_max(b);
+        ASSERT(lat_bucket(max)==b,1)
+        ASSERT(lat_bucket(max+1)==b+1,1)
+    }
+}
+
+static void test_percentiles() {
+    swistat_clear();
+    for(uint32_t i=0; i<98; i++) {
+        swistat_record(SWI_YIELD,100);
+    }
+    swistat_record(SWI_YIELD,1000);
+    swistat_record(SWI_YIELD,5000);
+    swistat_record(SWI_GET_PID,50);
+
+    uint32_t swi = 0;
+    const LatHist * h = swistat_next(&swi);
+    ASSERT(swi==SWI_GET_PID && h->count==1 && h->max==50,1)
+    swi++;
+    h = swistat_next(&swi);
+    ASSERT(swi==SWI_YIELD && h->count==100 && h->max==5000,1)
+    // percentiles are the upper bound of their bucket, capped by the max
+    ASSERT(lat_percentile(h,50)==lat_bucket_max(lat_bucket(100)),1)
+    ASSERT(lat_percentile(h,99)==lat_bucket_max(lat_bucket(1000)),1)
+    ASSERT(lat_percentile(h,100)==5000,1)
+    swi++;
+    ASSERT(swistat_next(&swi)==NULL,1)
+
+    swistat_clear();
+    swi = 0;
+    ASSERT(swistat_next(&swi)==NULL,1)
+}
+
+int main(int argc, char ** argv) {
+    test_buckets();
+    test_percentiles();
+    return 0;
+}
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+"""
+Symbolize a TOAST profile dump into flat and per-process profiles.
+
+Start the profiler from the console with `prof start [N]`, let it run, then
+`prof stop` and `prof dump`. Capture the console output to a file (e.g. with
+`screen -L`), then run:
+
+    tools/prof2sym.py build/kernel.elf screenlog.0
+
+Symbols are read with `arm-none-eabi-nm`; use --nm to pick another nm.
+
+With --ld, also write a hot.ld linker script fragment for a HOT_TEXT=1 build:
+the kernel entry paths, then the sampled functions that account for --ld-percent
+of the samples, hottest first, so they are packed together in .text.
+
+This script is the source of truth for src/hot.ld. Without a profile, it
+writes just the kernel entry paths (the hot.ld checked in):
+
+    tools/prof2sym.py --ld src/hot.ld
+"""
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+OTHER_PC = 0  # Samples that didn't fit in the histogram (see profile.h)
+
+
+def read_symbols(nm, elf):
+    """Returns sorted (address, name) of the functions in the ELF file"""
+    out = subprocess.run([nm, "-n", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] in "tTwW":
+            symbols.append((int(parts[0], 16), parts[2]))
+    return symbols
+
+
+def read_dump(lines):
+    """Returns [(pid, pc, count)] from the last complete profile dump in the capture"""
+    samples = None
+    last = None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("PROF-BEGIN"):
+            samples = []
+        elif line.startswith("PROF-END"):
+            last = samples
+            samples = None
+        elif samples is not None and line.startswith("PROF "):
+            parts = line.split()
+            if len(parts) == 4:
+                samples.append((int(parts[1]), int(parts[2], 16), int(parts[3])))
+    return last
+
+
+def symbolize(symbols, pc):
+    if pc == OTHER_PC:
+        return "[other]"
+    i = bisect.bisect_right([a for a, _ in symbols], pc) - 1
+    return symbols[i][1] if i >= 0 else "0x%x" % pc
+
+
+# Run on every SWI and IRQ, so they always come first (the profiler only samples User-mode).
+# Edit here, not in src/hot.ld, and regenerate it with: tools/prof2sym.py --ld src/hot.ld
+KERNEL_ENTRY = [
+    "s_schedule", "s_sys_router", "p_ready", "p_pop_ready", "p_rouse",
+    "q_insert_uint32", "q_insert_uint64", "q_pop", "q_remove",
+    "perf_charge", "swistat_record", "lat_bucket", "cycle_counter", "system_timer", "pmu_read",
+    "gpio_irq_pending", "uart_irq_pending", "prof_tick",
+]
+
+
+def write_ld(path, flat, percent):
+    """Writes the hot.ld fragment: the kernel entry paths, then the hottest sampled functions"""
+    names = list(KERNEL_ENTRY)
+    total = sum(flat.values())
+    covered = 0
+    for name, count in flat.most_common():
+        if covered >= total * percent / 100.0:
+            break
+        covered += count
+        if name not in names and not name.startswith(("[", "0x")):
+            names.append(name)
+    with open(path, "w") as f:
+        f.write("/* Hot functions, hottest first; included in .text by kernel.ld.\n")
+        if total:
+            f.write("   Generated by tools/prof2sym.py --ld from %d samples */\n" % total)
+        else:
+            f.write("   Generated by tools/prof2sym.py --ld: the kernel entry paths, which run on every\n")
+            f.write("   SWI and IRQ. Add the rest from a profile of your workload (see prof2sym.py) */\n")
+        for name in names:
+            f.write("*(.text.%s .text.%s.*)\n" % (name, name))
+
+
+def print_profile(title, counts):
+    total = sum(counts.values())
+    print("%s (%d samples)" % (title, total))
+    print("%10s %7s  %s" % ("samples", "%", "function"))
+    for name, count in counts.most_common():
+        print("%10d %6.2f%%  %s" % (count, 100.0 * count / total, name))
+    print()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("elf", nargs="?", help="kernel.elf")
+    parser.add_argument("capture", nargs="?", help="console capture containing a profile dump")
+    parser.add_argument("--nm", default="arm-none-eabi-nm", help="nm command (default: %(default)s)")
+    parser.add_argument("--ld", help="write a hot.ld linker script fragment (see HOT_TEXT in the Makefile)")
+    parser.add_argument("--ld-percent", type=float, default=90,
+                        help="share of the samples covered by the hot.ld functions (default: %(default)s)")
+    args = parser.parse_args()
+
+    if not args.capture:
+        if not args.ld or args.elf:
+            parser.error("elf and capture are required, unless only writing the kernel entry paths with --ld")
+        write_ld(args.ld, collections.Counter(), args.ld_percent)
+        return
+
+    symbols = read_symbols(args.nm, args.elf)
+    with open(args.capture, errors="replace") as f:
+        samples = read_dump(f)
+    if not samples:
+        sys.exit("no profile dump found in " + args.capture)
+
+    flat = collections.Counter()
+    by_pid = collections.defaultdict(collections.Counter)
+    for pid, pc, count in samples:
+        name = symbolize(symbols, pc)
+        flat[name] += count
+        by_pid[pid][name] += count
+
+    print_profile("Flat profile", flat)
+    for pid in sorted(by_pid):
+        print_profile("Process %d" % pid, by_pid[pid])
+    if args.ld:
+        write_ld(args.ld, flat, args.ld_percent)
+
+
+if __name__ == "__main__":
+    main()
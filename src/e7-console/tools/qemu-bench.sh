@@ -0,0 +1,46 @@
+#!/bin/bash
+# Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+#
+# Boot a kernel built with APP=bench under QEMU, and print the benchmark
+# results (the lines between BENCH-BEGIN and BENCH-END).
+#
+# Usage: qemu-bench.sh build/kernel.elf
+#
+# Environment:
+#   QEMU_MACHINE   raspi1ap (default), raspi0, or raspi2b (for BOARD=rpi2)
+#   CONSOLE        mini (default) or pl011 - the UART the kernel was built for
+#   BENCH_TIMEOUT  seconds to wait for the results (default 120)
+set -u
+kernel=${1:?usage: $0 kernel.elf}
+machine=${QEMU_MACHINE:-raspi1ap}
+timeout=${BENCH_TIMEOUT:-120}
+
+# QEMU's first serial port is the PL011, the second is the mini UART
+if [ "${CONSOLE:-mini}" = "pl011" ]; then
+    serial="-serial file:/dev/stdout"
+else
+    serial="-serial null -serial file:/dev/stdout"
+fi
+
+out=$(mktemp)
+trap 'rm -f "$out"' EXIT
+qemu-system-arm -M "$machine" -kernel "$kernel" -display none -monitor none $serial > "$out" &
+qemu=$!
+
+for ((i=0; i<timeout; i++)); do
+    grep -q BENCH-END "$out" && break
+    kill -0 $qemu 2>/dev/null || break
+    sleep 1
+done
+kill $qemu 2>/dev/null
+wait $qemu 2>/dev/null
+
+tr -d '\r' < "$out" | sed -n '/^BENCH-BEGIN/,/^BENCH-END/p' | grep '^BENCH'
+if ! grep -q BENCH-END "$out"; then
+    echo "qemu-bench: no results after ${timeout}s" >&2
+    exit 1
+fi
+if grep -q '^BENCH .*error=' "$out"; then
+    echo "qemu-bench: some benchmarks failed" >&2
+    exit 1
+fi
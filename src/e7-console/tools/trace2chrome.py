@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+# Copyright (c) 2020, 2024 Thomas Mikalsen. Subject to the MIT License
+"""
+Convert a TOAST kernel trace dump into Chrome trace JSON.
+
+The kernel writes the trace ring to the console on panic (see trace.c). Capture
+the console output to a file (e.g. with `screen -L`), then run:
+
+    tools/trace2chrome.py screenlog.0 > trace.json
+
+and load trace.json in chrome://tracing or https://ui.perfetto.dev
+"""
+import json
+import os
+import re
+import sys
+
+# Trace record types (see trace.h)
+TR_SWITCH = 1
+TR_SWI_ENTER = 2
+TR_SWI_EXIT = 3
+TR_IRQ = 4
+TR_MON_ENTER = 5
+TR_MON_EXIT = 6
+TR_MON_WAIT = 7
+TR_MON_NOTIFY = 8
+TR_SLEEP = 9
+TR_ROUSE = 10
+TR_TYPE_MASK = 0x0F
+TR_CPU_SHIFT = 4  # The core that wrote the record, in the high nibble of the type byte
+
+SYSCALLS_DEF = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src", "syscalls.def")
+
+
+def swi_names(path=SYSCALLS_DEF):
+    """SWI number -> name, from the SYSCALL entries in syscalls.def"""
+    names = {}
+    try:
+        for line in open(path):
+            m = re.match(r"SYSCALL\(\s*(0x[0-9A-Fa-f]+)\s*,\s*\w+\s*,\s*(\w+)", line)
+            if m:
+                names[int(m.group(1), 16)] = m.group(2)
+    except OSError:
+        pass
+    return names
+
+
+MON_NAMES = {
+    TR_MON_ENTER: "mon_enter", TR_MON_EXIT: "mon_exit",
+    TR_MON_WAIT: "mon_wait", TR_MON_NOTIFY: "mon_notify",
+}
+
+IRQ_TID = 1000  # Lanes used for interrupts, one per core
+CPU_TID = 2000  # Lanes showing the process running on each core
+
+
+def read_dump(lines):
+    """Yields (records, cycles_per_second) for each dump in the capture; records are
+    (cycles, type, cpu, pid, arg)"""
+    records = None
+    hz = 0
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE-BEGIN"):
+            fields = line.split()
+            hz = int(fields[3])
+            records = []
+        elif line.startswith("TRACE-END"):
+            if records is not None:
+                yield records, hz
+            records = None
+        elif records is not None:
+            try:
+                cycles, word = (int(f, 16) for f in line.split())
+            except ValueError:
+                continue  # Ignore noise on the console
+            records.append((cycles, word & TR_TYPE_MASK, (word & 0xFF) >> TR_CPU_SHIFT,
+                            (word >> 8) & 0xFF, word >> 16))
+
+
+def running_slice(cpu, pid, start, end):
+    """The process pid running on core cpu from start to end, in the core's lane"""
+    return {"name": "pid %d" % pid, "cat": "running", "ph": "X", "pid": 0, "tid": CPU_TID + cpu,
+            "ts": start, "dur": end - start, "args": {"pid": pid}}
+
+
+def to_chrome(records, hz):
+    names = swi_names()
+    events = []
+    # Unwrap the 32-bit cycle counter
+    base = 0
+    prev = None
+    running = {}  # cpu -> (pid, start ts); the cores switch independently
+    for cycles, rtype, cpu, pid, arg in records:
+        if prev is not None and cycles < prev:
+            base += 1 << 32
+        prev = cycles
+        ts = (base + cycles) * 1e6 / hz
+        if rtype == TR_SWITCH:
+            if cpu in running:
+                rpid, start = running[cpu]
+                events.append(running_slice(cpu, rpid, start, ts))
+            running[cpu] = (arg, ts)
+        elif rtype in (TR_SWI_ENTER, TR_SWI_EXIT):
+            name = names.get(arg, "swi 0x%04x" % arg)
+            events.append({"name": name, "cat": "swi", "ph": "B" if rtype == TR_SWI_ENTER else "E",
+                           "pid": 0, "tid": pid, "ts": ts})
+        elif rtype == TR_IRQ:
+            events.append({"name": "irq", "cat": "irq", "ph": "i", "s": "t", "pid": 0,
+                           "tid": IRQ_TID + cpu, "ts": ts, "args": {"pending": arg, "interrupted": pid}})
+        elif rtype in MON_NAMES:
+            events.append({"name": MON_NAMES[rtype], "cat": "monitor", "ph": "i", "s": "t",
+                           "pid": 0, "tid": pid, "ts": ts, "args": {"mid": arg}})
+        elif rtype in (TR_SLEEP, TR_ROUSE):
+            events.append({"name": "sleep" if rtype == TR_SLEEP else "rouse", "cat": "sleep",
+                           "ph": "i", "s": "t", "pid": 0, "tid": pid, "ts": ts})
+    if prev is not None:
+        for cpu, (rpid, start) in running.items():
+            events.append(running_slice(cpu, rpid, start, (base + prev) * 1e6 / hz))
+    tids = sorted({e["tid"] for e in events})
+    for tid in tids:
+        if tid >= CPU_TID:
+            name = "cpu %d" % (tid - CPU_TID)
+        elif tid >= IRQ_TID:
+            name = "irq cpu %d" % (tid - IRQ_TID)
+        else:
+            name = "pid %d" % tid
+        events.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": tid, "args": {"name": name}})
+    events.append({"name": "process_name", "ph": "M", "pid": 0, "args": {"name": "TOAST"}})
+    return events
+
+
+def main(argv):
+    if len(argv) > 2:
+        print("usage: %s [console-capture]" % argv[0], file=sys.stderr)
+        return 2
+    src = open(argv[1], errors="replace") if len(argv) == 2 else sys.stdin
+    dumps = list(read_dump(src))
+    if not dumps:
+        print("no trace dump found", file=sys.stderr)
+        return 1
+    # Use the last dump in the capture
+    records, hz = dumps[-1]
+    json.dump({"traceEvents": to_chrome(records, hz), "displayTimeUnit": "ns"}, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))